@@ -0,0 +1,76 @@
+// Hit geometry lookup, expects attribs, hitValue, geometries and texSamplers[] to be declared by the includer
+
+layout(buffer_reference, scalar, buffer_reference_align = 4) readonly buffer VertexRef { PackedVertex v[]; };
+layout(buffer_reference, scalar, buffer_reference_align = 4) readonly buffer IndexRef { uint i[]; };
+layout(buffer_reference, scalar, buffer_reference_align = 4) readonly buffer MaterialRef { Material m; };
+layout(buffer_reference, scalar, buffer_reference_align = 4) readonly buffer PrimitiveRef { uint p[]; };
+
+// Ray cone spread in radians, bounces off diffuse surfaces get a much wider cone
+#define PRIMARY_CONE_SPREAD 0.001f
+#define BOUNCE_CONE_SPREAD  0.05f
+
+Vertex barycentricVertex(Vertex v0, Vertex v1, Vertex v2) {
+    const vec3 barycentric = vec3(1.0f - attribs.x - attribs.y, attribs.x, attribs.y);
+	const vec3 origin    = gl_WorldRayOriginEXT + gl_WorldRayDirectionEXT * gl_HitTEXT;
+    const vec3 normal    = v0.normal * barycentric.x + v1.normal * barycentric.y + v2.normal * barycentric.z;
+    const vec2 texCoord  = v0.texCoord * barycentric.x + v1.texCoord * barycentric.y + v2.texCoord * barycentric.z;
+    const vec3 tangent   = v0.tangent * barycentric.x + v1.tangent * barycentric.y + v2.tangent * barycentric.z;
+    const vec3 bitangent = v0.bitangent * barycentric.x + v1.bitangent * barycentric.y + v2.bitangent * barycentric.z;
+
+    // Attributes are stored in object space, normals go through the inverse transpose
+    const vec3 worldNormal    = normalize(vec3(normal * gl_WorldToObjectEXT));
+    const vec3 worldTangent   = gl_ObjectToWorldEXT * vec4(tangent, 0.0f);
+    const vec3 worldBitangent = gl_ObjectToWorldEXT * vec4(bitangent, 0.0f);
+
+    return Vertex(origin, worldNormal, texCoord, worldTangent, worldBitangent);
+}
+
+uint fetchIndex(Geometry geometry, uint k) {
+    IndexRef indices = IndexRef(geometry.indices);
+
+    if ((geometry.flags & GEOMETRY_SHORT_INDICES) != 0u) {
+        uint word = indices.i[k / 2];
+        return ((k & 1u) == 0u) ? (word & 0xFFFFu) : (word >> 16);
+    }
+
+    return indices.i[k];
+}
+
+Vertex hitVertex(uint instance) {
+    const Geometry geometry = geometries.g[instance];
+    VertexRef vertices = VertexRef(geometry.vertices);
+
+    // Indices of the Triangle
+    const uint first = 3 * gl_PrimitiveID;
+    uvec3 index = uvec3(fetchIndex(geometry, first + 0),
+                        fetchIndex(geometry, first + 1),
+                        fetchIndex(geometry, first + 2));
+
+    // Vertex of the Triangle
+    Vertex v0 = unpackVertex(vertices.v[index.x]);
+    Vertex v1 = unpackVertex(vertices.v[index.y]);
+    Vertex v2 = unpackVertex(vertices.v[index.z]);
+
+    return barycentricVertex(v0, v1, v2);
+}
+
+Material hitMaterial(uint instance) {
+    const Geometry geometry = geometries.g[instance];
+
+    // Merged meshes keep the material of every source mesh
+    if ((geometry.flags & GEOMETRY_MERGED) != 0u)
+        return MaterialRef(geometries.g[PrimitiveRef(geometry.primitives).p[gl_PrimitiveID]].material).m;
+
+    return MaterialRef(geometry.material).m;
+}
+
+vec3 sampleDiffuse(Material mat, Vertex v) {
+    const ivec2 size   = textureSize(texSamplers[nonuniformEXT(mat.diffuseIndex)], 0);
+    const float spread = (hitValue.depth == 0) ? PRIMARY_CONE_SPREAD : BOUNCE_CONE_SPREAD;
+    const float cosine = max(abs(dot(v.normal, gl_WorldRayDirectionEXT)), 0.1f);
+
+    // Footprint in texels along one axis, using the mesh wide UV density
+    const float footprint = gl_HitTEXT * spread / cosine * mat.uvDensity * sqrt(float(size.x * size.y));
+
+    return textureLod(texSamplers[nonuniformEXT(mat.diffuseIndex)], v.texCoord, log2(max(footprint, 1e-6f))).xyz;
+}
@@ -7,6 +7,42 @@ struct Vertex
   vec3 bitangent;
 };
 
+// Matches PackedVertex::noTangent, no tangent encodes to it
+#define PACKED_NO_TANGENT 0x80008000u
+
+struct PackedVertex
+{
+  uint normal;
+  uint texCoord;
+  uint tangent;
+};
+
+vec3 octDecode(vec2 oct)
+{
+  vec3 n = vec3(oct, 1.0f - abs(oct.x) - abs(oct.y));
+  if (n.z < 0.0f)
+    n.xy = (1.0f - abs(n.yx)) * vec2(n.x >= 0.0f ? 1.0f : -1.0f, n.y >= 0.0f ? 1.0f : -1.0f);
+  return normalize(n);
+}
+
+// Position is left empty, hits reconstruct it from the ray
+Vertex unpackVertex(PackedVertex p)
+{
+  Vertex v;
+  v.pos = vec3(0.0f);
+  v.normal = octDecode(unpackSnorm2x16(p.normal));
+  v.texCoord = unpackHalf2x16(p.texCoord);
+
+  if (p.tangent != PACKED_NO_TANGENT)
+    v.tangent = octDecode(unpackSnorm2x16(p.tangent));
+  else
+    v.tangent = abs(v.normal.x) > 0.9f ? vec3(0.0f, 1.0f, 0.0f) : vec3(1.0f, 0.0f, 0.0f);
+
+  v.tangent = normalize(v.tangent - v.normal * dot(v.normal, v.tangent));
+  v.bitangent = cross(v.normal, v.tangent);
+  return v;
+}
+
 struct Material
 {
   vec3 ambient;
@@ -19,6 +55,42 @@ struct Material
   float dissolve;
   int shadingModel;
   int diffuseMapCount;
+  int diffuseIndex;
+  float uvDensity;
+};
+
+struct AliasEntry
+{
+  float prob;
+  uint alias;
+  float pdf;
+};
+
+// Light BVH node, the first child of an inner node follows it
+struct LightNode
+{
+  vec3 lo;
+  float power;
+  vec3 hi;
+  uint child;
+  vec3 axis;
+  float cosTheta;
+};
+
+#define LIGHT_LEAF 0x80000000u
+
+#define GEOMETRY_SHORT_INDICES 1u
+#define GEOMETRY_MERGED 2u
+
+// Device addresses of a mesh inside the merged buffers
+struct Geometry
+{
+  uvec2 vertices;
+  uvec2 indices;
+  uvec2 material;
+  uvec2 primitives;
+  uint flags;
+  uint reserved;
 };
 
 struct hitPayload
@@ -0,0 +1,28 @@
+// Light selection through the power alias table, expects aliasTable and sizes.lightsSize to be declared by the includer
+
+// Picks a light in proportion to its power, reused is what is left of eps to place the sample on it
+uint pickLight(float eps, out float reused) {
+    const float scaled = eps * sizes.lightsSize;
+    const uint  slot = min(uint(scaled), sizes.lightsSize - 1u);
+    const float frac = min(scaled - slot, 0.99999994f);
+    const AliasEntry entry = aliasTable.a[slot];
+
+    if (frac < entry.prob) {
+        reused = frac / entry.prob;
+        return slot;
+    }
+
+    reused = (frac - entry.prob) / max(1.0f - entry.prob, 1e-6f);
+    return entry.alias;
+}
+
+// Inverse of pickLight, the eps that picks light and leaves reused. Only holds for lights pickLight can
+// return, ones without power have prob 0 unless no light has any.
+float lightEps(uint light, float reused) {
+    return (float(light) + reused * aliasTable.a[light].prob) / float(sizes.lightsSize);
+}
+
+// Relative to a uniform pick, which is what the light pdfs used to assume
+float pickPdf(uint light) {
+    return aliasTable.a[light].pdf;
+}
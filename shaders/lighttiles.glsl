@@ -0,0 +1,28 @@
+// Lights presampled from the alias table every frame, filled by lighttiles.comp and read by the hit
+// shaders. The sizes must match App::lightTileCount and App::lightTileSize.
+
+#define LIGHT_TILES 128u
+#define LIGHT_TILE_SIZE 1024u
+#define SCREEN_TILE 16u
+
+// Everything a candidate needs without touching lights.l[]
+struct TileSample
+{
+  vec3 pos;
+  float invPdf; // 1 / (pickPdf * lgtPdf)
+  vec3 normal;
+  float X; // Alias table encoding, as stored in reservoirs
+  float Y;
+};
+
+// One light tile for every screen tile, a new one each frame
+uint screenLightTile(uvec2 pixel, uint frame) {
+    uvec2 tile = pixel / SCREEN_TILE;
+    uint hash = (tile.x * 73856093u) ^ (tile.y * 19349663u) ^ (frame * 83492791u);
+
+    hash ^= hash >> 16;
+    hash *= 0x7feb352du;
+    hash ^= hash >> 15;
+
+    return hash % LIGHT_TILES;
+}
@@ -0,0 +1,62 @@
+// Stochastic light BVH descent, expects lightTree and sizes.lightsSize to be declared by the includer
+
+// Upper bound of what the lights below node send towards p
+float nodeImportance(LightNode node, vec3 p) {
+    if (node.power <= 0.0f)
+        return 0.0f;
+
+    const vec3  center = 0.5f * (node.lo + node.hi);
+    const float radius2 = 0.25f * dot(node.hi - node.lo, node.hi - node.lo);
+    const vec3  toPoint = p - center;
+    const float dist2 = dot(toPoint, toPoint);
+
+    // Inside the bounds every direction is possible
+    if (dist2 <= radius2)
+        return node.power / max(radius2, 1e-6f);
+
+    const float cosTheta = dot(node.axis, toPoint * inversesqrt(dist2));
+    const float thetaO = acos(clamp(node.cosTheta, -1.0f, 1.0f));
+    const float thetaU = asin(sqrt(radius2 / dist2));
+    const float theta  = max(acos(clamp(cosTheta, -1.0f, 1.0f)) - thetaO - thetaU, 0.0f);
+
+    // Pads only emit on the side of their normal
+    if (theta >= 1.57079632f)
+        return 0.0f;
+
+    return node.power * cos(theta) / dist2;
+}
+
+// Walks down with eps, which is left uniform for placing the sample on the light. pdf is the chance
+// of the picked light relative to a uniform pick, like pickPdf().
+uint pickLightTree(vec3 p, inout float eps, out float pdf) {
+    uint  node = 0u;
+    float pmf = 1.0f;
+
+    while ((lightTree.n[node].child & LIGHT_LEAF) == 0u) {
+        const uint  second = lightTree.n[node].child;
+        const float left   = nodeImportance(lightTree.n[node + 1u], p);
+        const float right  = nodeImportance(lightTree.n[second], p);
+
+        // Without importance fall back to power, a subtree without any is never entered since its
+        // lights have no alias table slot of their own and lightEps() couldn't encode them
+        const float powerLeft  = lightTree.n[node + 1u].power;
+        const float powerRight = lightTree.n[second].power;
+        const float pLeft = (left + right > 0.0f) ? left / (left + right)
+            : (powerLeft + powerRight > 0.0f) ? powerLeft / (powerLeft + powerRight) : 0.5f;
+
+        if (eps < pLeft) {
+            eps /= pLeft;
+            pmf *= pLeft;
+            node = node + 1u;
+        } else {
+            eps = (eps - pLeft) / (1.0f - pLeft);
+            pmf *= 1.0f - pLeft;
+            node = second;
+        }
+
+        eps = min(eps, 0.99999994f);
+    }
+
+    pdf = pmf * sizes.lightsSize;
+    return lightTree.n[node].child & ~LIGHT_LEAF;
+}
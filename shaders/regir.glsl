@@ -0,0 +1,30 @@
+// World space light grid around the camera, filled by regir.comp and read by the hit shaders.
+// The sizes must match App::regirDim and App::regirSlots.
+
+#define REGIR_DIM 32u
+#define REGIR_SLOTS 8u
+#define REGIR_CELLS (REGIR_DIM * REGIR_DIM * REGIR_DIM)
+
+// A light reservoir, X and Y in the alias table encoding and W its contribution weight
+struct GridSample
+{
+  float X;
+  float Y;
+  float W;
+};
+
+// Snapped to whole cells, so cells don't shift under the lights while the camera moves
+vec3 gridOrigin(vec3 cameraPos, float cellSize) {
+    return (floor(cameraPos / cellSize) - 0.5f * float(REGIR_DIM)) * cellSize;
+}
+
+// origin.w is the cell size
+bool gridCell(vec4 origin, vec3 p, out uint cell) {
+    const ivec3 c = ivec3(floor((p - origin.xyz) / origin.w));
+
+    if (any(lessThan(c, ivec3(0))) || any(greaterThanEqual(c, ivec3(REGIR_DIM))))
+        return false;
+
+    cell = (uint(c.z) * REGIR_DIM + uint(c.y)) * REGIR_DIM + uint(c.x);
+    return true;
+}
@@ -17,6 +17,7 @@
 #include <any>
 #include <random>
 #include <limits>
+#include <algorithm>
 
 #include <hdvw/window.hpp>
 #include <hdvw/instance.hpp>
@@ -36,16 +37,24 @@
 #include <hdvw/fence.hpp>
 #include <hdvw/vertex.hpp>
 #include <hdvw/databuffer.hpp>
+#include <hdvw/uploadbatch.hpp>
 #include <hdvw/texture.hpp>
 #include <hdvw/descriptorlayout.hpp>
 #include <hdvw/descriptorpool.hpp>
 #include <hdvw/descriptorset.hpp>
 
 #include <engine/utils.hpp>
+#include <engine/threadpool.hpp>
 #include <engine/blas.hpp>
+#include <engine/blasbuilder.hpp>
 #include <engine/tlas.hpp>
+#include <engine/dynamicscene.hpp>
 #include <engine/sbt.hpp>
 #include <engine/model.hpp>
+#include <engine/scenecache.hpp>
+#include <engine/accelcache.hpp>
+#include <engine/uploadstream.hpp>
+#include <engine/texturecache.hpp>
 #include <engine/camera.hpp>
 #include <engine/saveimg.hpp>
 
@@ -62,6 +71,21 @@ struct params_t {
     bool accumulate;
     bool immediate = false;
     bool multiply = false;
+    bool weld = false;
+    bool rebuildCache = false;
+    bool compactBLAS = false;
+    bool animateLights = false;
+    bool hostBuilds = false;
+    bool mergeStatic = false;
+    bool lightTree = false;
+    float regirCell = 0.0f;
+    bool lightTiles = false;
+    uint32_t spatialPasses = 1;
+    uint32_t spatialNeighbors = 5;
+    float spatialRadius = 30.0f;
+    std::string lights = "models/scene.json";
+    std::string packLights;
+    bool cook = false;
 };
 
 struct UniformData {
@@ -84,6 +108,9 @@ struct UniSizes {
     alignas(4) uint32_t lightsSize;
     alignas(4) uint32_t M;
     alignas(4) uint32_t C;
+    alignas(4) uint32_t useLightTree;
+    alignas(4) uint32_t useLightGrid;
+    alignas(4) uint32_t useLightTiles;
 };
 
 struct PushWindowSize {
@@ -92,6 +119,13 @@ struct PushWindowSize {
     alignas(4) uint32_t C;
 };
 
+// Follows PushWindowSize in the compute push constants, selects the reservoirs a spatial pass reads and writes
+struct PushSpatialPass {
+    alignas(4) uint32_t pass;
+    alignas(4) uint32_t src;
+    alignas(4) uint32_t dst;
+};
+
 struct UniCount {
     alignas(4) uint32_t count;
 };
@@ -101,10 +135,27 @@ struct UniFrames {
     alignas(4)  uint32_t lightsSize;
     alignas(4)  uint32_t frames;
     alignas(16) glm::vec3 cameraPos;
+    alignas(4)  float gridCellSize;
+    alignas(4)  uint32_t spatialNeighbors;
+    alignas(4)  float spatialRadius;
 };
 
 class App {
     private:
+        // Light grid cells along each axis and reservoirs per cell, as in shaders/regir.glsl
+        static constexpr uint32_t regirDim = 32;
+        static constexpr uint32_t regirSlots = 8;
+
+        // Reservoir images of a spatial pass, as in shaders/spatial.comp
+        static constexpr uint32_t reservoirPresent = 0;
+        static constexpr uint32_t reservoirSpatial = 1;
+        static constexpr uint32_t reservoirPast = 2;
+
+        // Presampled light tiles and lights per tile, as in shaders/lighttiles.glsl
+        static constexpr uint32_t lightTileCount = 128;
+        static constexpr uint32_t lightTileSize = 1024;
+        static constexpr vk::DeviceSize tileSampleSize = 9 * sizeof(float);
+
         params_t params;
         UniSizes uniSizes{};
 
@@ -118,25 +169,42 @@ class App {
         hd::Queue graphicsQueue;
         hd::Queue presentQueue;
         hd::CommandPool graphicsPool;
+        hd::ThreadPool threadPool;
+        hd::TextureCache textureCache;
+        hd::UploadStream uploadStream;
+        hd::DynamicScene dynamicScene;
+        std::vector<hd::Light> animatedLights;
 
         std::vector<hd::Semaphore> imageAvailable;
         std::vector<hd::Semaphore> renderFinished;
         std::vector<hd::Fence> inFlightFences;
 
         struct vram {
-            using vram_vertices = hd::DataBuffer<hd::Vertex>;
+            using vram_positions = hd::DataBuffer<glm::vec3>;
+            using vram_vertices = hd::DataBuffer<hd::PackedVertex>;
             using vram_indices  = hd::DataBuffer<uint32_t>;
             using vram_texture  = hd::Texture;
             using vram_material = hd::DataBuffer<hd::Material>;
+            using vram_geometry = hd::DataBuffer<hd::VRAM_Geometry>;
 
-            std::vector<vram_vertices> vertices;
-            std::vector<vram_indices>  indices;
+            // Every mesh suballocated from one buffer each, geometries holds their addresses
+            vram_positions positions;
+            vram_vertices vertices;
+            vram_indices  indices;
             std::vector<vram_texture>  diffuse;
-            std::vector<vram_material> materials;
-
-            std::vector<vram_vertices> lightVertices;
-            std::vector<vram_indices> lightIndices;
+            vram_material materials;
+            vram_geometry geometries;
+            vram_indices primitiveMeshes; // Source mesh of every triangle of the merged meshes
+
+            // Every light pad merged into one BLAS, lightPrimitives maps its triangles to lights
+            vram_positions lightPositions;
+            vram_indices lightIndices;
+            vram_indices lightPrimitives;
             hd::DataBuffer<hd::VRAM_Light> lights;
+            hd::DataBuffer<hd::VRAM_AliasEntry> lightAlias; // Power proportional light picks
+            hd::DataBuffer<hd::VRAM_LightNode> lightTree; // Picks by power and distance to the hit
+            hd::Buffer lightGrid; // Origin and cell size, then regirSlots light reservoirs per cell
+            hd::Buffer lightTiles; // Frame of the fill, then lightTileCount * lightTileSize presampled lights
 
             hd::DataBuffer<UniSizes> uniSizes;
 
@@ -159,6 +227,7 @@ class App {
                 workImage vnorm;
                 workImage vmat;
                 workImage past;
+                workImage spatial; // Ping-pongs with present between spatial passes
             } reservoir;
 
             hd::DataBuffer<UniformData> unibuffer;
@@ -176,6 +245,8 @@ class App {
 
         hd::Pipeline summPipeline;
         hd::Pipeline spatialPipeline;
+        hd::Pipeline regirPipeline;
+        hd::Pipeline lightTilesPipeline;
 
         hd::DescriptorLayout rayLayout;
         hd::PipelineLayout rayPipeLayout;
@@ -183,7 +254,19 @@ class App {
         hd::Pipeline rayPipeline;
         hd::SBT sbt;
 
-        inline auto populateInitialVRAM(hd::Model scene, std::vector<hd::Light>& lights) {
+        // Everything is recorded into uploads, nothing is resident before it is flushed
+        inline auto populateInitialVRAM(hd::Model scene, std::span<const hd::Light> lights) {
+            auto newUploads = [&]() {
+                return hd::UploadBatch_t::conjure({
+                        .commandPool = graphicsPool,
+                        .queue = graphicsQueue,
+                        .allocator = allocator,
+                        .device = device,
+                        });
+            };
+
+            auto uploads = newUploads();
+
             auto fillVRAMBuffer = [&]<class T>(std::vector<T> const& data, vk::BufferUsageFlags flags, VmaMemoryUsage usage = VMA_MEMORY_USAGE_GPU_ONLY) {
                 return hd::conjure<T>({
                         .commandPool = graphicsPool,
@@ -193,97 +276,309 @@ class App {
                         .data = data,
                         .usage = flags,
                         .memoryUsage = usage,
+                        .batch = uploads,
                         });
             };
 
-            vram.vertices.reserve(scene->meshes.size());
-            vram.indices.reserve(scene->meshes.size());
-            vram.diffuse.reserve(scene->meshes.size());
-            vram.blases.reserve(scene->meshes.size());
+            vram.blases.reserve(scene->meshes.size() + 1);
 
             std::vector<vk::AccelerationStructureInstanceKHR> instances;
-            instances.reserve(scene->meshes.size());
+            instances.reserve(scene->instances.size() + 1);
 
-            vk::TransformMatrixKHR vkDefault_transform = []() {
-                glm::mat4 transform = glm::mat4(1.0f);
-                const float *ptransform = (const float*)glm::value_ptr(transform);
+            // Vulkan wants the top 3 rows in row major order, glm is column major
+            auto vkTransform = [](glm::mat4 const& transform) {
+                glm::mat4 rows = glm::transpose(transform);
+                const float *ptransform = (const float*)glm::value_ptr(rows);
 
                 vk::TransformMatrixKHR vkTransform;
                 memcpy(&vkTransform.matrix, ptransform, 3 * 4 * sizeof(float));
 
                 return vkTransform;
-            }();
+            };
 
             vk::AccelerationStructureInstanceKHR instanceInfo{};
-            instanceInfo.transform = vkDefault_transform;
             instanceInfo.mask = 0xFF;
             instanceInfo.instanceShaderBindingTableRecordOffset = 0; // HitGroupId
             instanceInfo.setFlags(vk::GeometryInstanceFlagBitsKHR::eTriangleFacingCullDisable);
 
+            // Positions feed the BLAS builds, hit shaders only fetch the packed attributes
+            auto splitVertices = [](std::vector<hd::Vertex> const& vertices) {
+                std::pair<std::vector<glm::vec3>, std::vector<hd::PackedVertex>> streams;
+                streams.first.reserve(vertices.size());
+                streams.second.reserve(vertices.size());
+
+                for (auto const& vertex : vertices) {
+                    streams.first.push_back(vertex.pos);
+                    streams.second.push_back(hd::PackedVertex::pack(vertex));
+                }
+
+                return streams;
+            };
+
+            // Lay the meshes out back to back, small meshes get 16 bit indices
+            struct Layout {
+                uint32_t vertexOffset;
+                uint32_t indexOffset; // In 32 bit words
+                bool shortIndices;
+            };
+
+            std::vector<Layout> layouts(scene->meshes.size());
+            std::vector<hd::Material> materials(scene->meshes.size());
+
+            uint32_t vertexCount = 0;
+            uint32_t indexWords = 0;
             for (uint32_t iter = 0; iter < scene->meshes.size(); iter++) {
-                vram.vertices.push_back(fillVRAMBuffer(scene->meshes[iter].vertices, vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eStorageBuffer));
-                vram.indices.push_back(fillVRAMBuffer(scene->meshes[iter].indices, vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eStorageBuffer));
-                vram.diffuse.push_back(scene->meshes[iter].diffuse[0]);
-                vram.materials.push_back(fillVRAMBuffer(std::vector{scene->meshes[iter].material}, vk::BufferUsageFlagBits::eStorageBuffer));
-
-                vram.blases.push_back(hd::conjure({
-                        vram.vertices.back(),
-                        vram.indices.back(),
-                        graphicsPool,
-                        graphicsQueue,
-                        device,
-                        allocator,
-                        }));
+                auto const& mesh = scene->meshes[iter];
+                const auto vertices = mesh.vertexData();
+                const auto indices = mesh.indexData();
+                bool shortIndices = vertices.size() <= 0x10000;
 
-                instanceInfo.instanceCustomIndex = iter; // InstanceId
-                instanceInfo.accelerationStructureReference = vram.blases[iter]->address();
-                instances.push_back(instanceInfo);
+                layouts[iter] = { vertexCount, indexWords, shortIndices };
+                materials[iter] = mesh.material;
+
+                vertexCount += vertices.size();
+                indexWords += shortIndices ? (indices.size() + 1) / 2 : indices.size();
+            }
+
+            std::vector<glm::vec3> positions(vertexCount);
+            std::vector<hd::PackedVertex> attributes(vertexCount);
+            std::vector<uint32_t> indexData(indexWords, 0);
+
+            threadPool->parallelFor(scene->meshes.size(), [&](size_t iter) {
+                // Straight from the mapped scene cache on a hit
+                const auto vertices = scene->meshes[iter].vertexData();
+                const auto indices = scene->meshes[iter].indexData();
+                auto const& layout = layouts[iter];
+
+                for (size_t vert = 0; vert < vertices.size(); vert++) {
+                    positions[layout.vertexOffset + vert] = vertices[vert].pos;
+                    attributes[layout.vertexOffset + vert] = hd::PackedVertex::pack(vertices[vert]);
+                }
+
+                if (layout.shortIndices) {
+                    for (size_t index = 0; index < indices.size(); index++)
+                        indexData[layout.indexOffset + index / 2] |= indices[index] << (16 * (index & 1));
+                } else
+                    std::copy(indices.begin(), indices.end(), indexData.begin() + layout.indexOffset);
+            });
+
+            vram.positions = fillVRAMBuffer(positions, vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR);
+            vram.vertices = fillVRAMBuffer(attributes, vk::BufferUsageFlagBits::eStorageBuffer);
+            vram.indices = fillVRAMBuffer(indexData, vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR | vk::BufferUsageFlagBits::eStorageBuffer);
+            vram.materials = fillVRAMBuffer(materials, vk::BufferUsageFlagBits::eStorageBuffer);
+
+            // Hit shaders reach the geometry through these addresses, no descriptor per mesh
+            std::vector<hd::VRAM_Geometry> geometries(scene->meshes.size());
+            for (uint32_t iter = 0; iter < scene->meshes.size(); iter++) {
+                geometries[iter].vertices = vram.vertices->address().deviceAddress + layouts[iter].vertexOffset * sizeof(hd::PackedVertex);
+                geometries[iter].indices = vram.indices->address().deviceAddress + layouts[iter].indexOffset * sizeof(uint32_t);
+                geometries[iter].material = vram.materials->address().deviceAddress + iter * sizeof(hd::Material);
+                geometries[iter].flags = layouts[iter].shortIndices ? hd::eGeometryShortIndices : 0;
+            }
+
+            // Merged meshes shade each triangle with the material of the mesh it came from
+            std::vector<uint32_t> primitiveMeshes;
+            std::vector<size_t> primitiveOffsets(scene->meshes.size());
+            for (uint32_t iter = 0; iter < scene->meshes.size(); iter++) {
+                primitiveOffsets[iter] = primitiveMeshes.size();
+                primitiveMeshes.insert(primitiveMeshes.end(), scene->meshes[iter].primitiveMeshes.begin(), scene->meshes[iter].primitiveMeshes.end());
             }
 
-            std::vector<hd::VRAM_Light> vram_lights;
-            vram_lights.reserve(lights.size());
+            if (!primitiveMeshes.empty()) {
+                vram.primitiveMeshes = fillVRAMBuffer(primitiveMeshes, vk::BufferUsageFlagBits::eStorageBuffer);
+
+                for (uint32_t iter = 0; iter < scene->meshes.size(); iter++) {
+                    if (scene->meshes[iter].primitiveMeshes.empty())
+                        continue;
+
+                    geometries[iter].primitives = vram.primitiveMeshes->address().deviceAddress + primitiveOffsets[iter] * sizeof(uint32_t);
+                    geometries[iter].flags |= hd::eGeometryMerged;
+                }
+            }
+
+            vram.geometries = fillVRAMBuffer(geometries, vk::BufferUsageFlagBits::eStorageBuffer);
+
+            // Every light places the same unit pad, all of them go into one BLAS in world space
+            auto unitPad = hd::Model_t::generateUnitLightPad();
+            if (params.weld)
+                hd::Model_t::weld(unitPad.vertices, unitPad.indices);
+
+            auto unitPadPositions = splitVertices(unitPad.vertices).first;
 
-            vram.lightVertices.reserve(lights.size());
-            vram.lightIndices.reserve(lights.size());
+            std::vector<hd::VRAM_Light> vram_lights(lights.size());
+            std::vector<glm::mat3x4> lightTransforms(lights.size());
 
-            for (uint32_t iter = 0; iter < lights.size(); iter++){
-                auto lightPad = hd::Model_t::generateLightPad(lights[iter]);
-                vram_lights.push_back(lightPad.props);
+            hd::Model_t::generateLightPads(lights, vram_lights, lightTransforms, threadPool);
 
-                vram.lightVertices.push_back(fillVRAMBuffer(lightPad.vertices, vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eStorageBuffer));
-                vram.lightIndices.push_back(fillVRAMBuffer(lightPad.indices, vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eStorageBuffer));
+            const size_t padVertices = unitPadPositions.size();
+            const size_t padTriangles = unitPad.indices.size() / 3;
+
+            std::vector<glm::vec3> lightPadPositions(lights.size() * padVertices);
+            std::vector<uint32_t> lightPadIndices(lights.size() * unitPad.indices.size());
+            std::vector<uint32_t> lightPadPrimitives(lights.size() * padTriangles);
+
+            hd::Model_t::placeLightPads(lightTransforms, unitPadPositions, lightPadPositions, threadPool);
+
+            threadPool->parallelFor(lights.size(), [&](size_t iter) {
+                for (size_t index = 0; index < unitPad.indices.size(); index++)
+                    lightPadIndices[iter * unitPad.indices.size() + index] = unitPad.indices[index] + iter * padVertices;
+
+                std::fill_n(lightPadPrimitives.begin() + iter * padTriangles, padTriangles, static_cast<uint32_t>(iter));
+            });
+
+            vram.lightPositions = fillVRAMBuffer(lightPadPositions, vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR);
+            vram.lightIndices = fillVRAMBuffer(lightPadIndices, vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR | vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eStorageBuffer);
+            vram.lightPrimitives = fillVRAMBuffer(lightPadPrimitives, vk::BufferUsageFlagBits::eStorageBuffer);
+
+            // One barrier for all the copies above, the builds after it don't depend on each other
+            uploads->barrier();
+
+            auto accelCache = hd::AccelCache_t::conjure({
+                    .filename = (params.multiply) ? "models/scene.100.hdaccel" : "models/scene.hdaccel",
+                    .device = device,
+                    .rebuild = params.rebuildCache,
+                    });
 
-                vram.blases.push_back(hd::conjure({
-                        vram.lightVertices.back(),
-                        vram.lightIndices.back(),
+            auto blasBuilder = hd::BLASBuilder_t::conjure({
+                    .commandPool = graphicsPool,
+                    .queue = graphicsQueue,
+                    .device = device,
+                    .allocator = allocator,
+                    .batch = uploads,
+                    .compact = params.compactBLAS,
+                    .onHost = params.hostBuilds,
+                    .pool = threadPool,
+                    .cache = accelCache,
+                    });
+
+            for (uint32_t iter = 0; iter < scene->meshes.size(); iter++) {
+                auto const& layout = layouts[iter];
+
+                // Merged away, only its material is still referenced
+                if (scene->meshes[iter].indexData().empty()) {
+                    vram.blases.push_back(nullptr);
+                    continue;
+                }
+
+                vram.blases.push_back(blasBuilder->add({
+                        vram.positions,
+                        vram.indices,
                         graphicsPool,
                         graphicsQueue,
                         device,
                         allocator,
+                        uploads,
+                        layout.vertexOffset,
+                        static_cast<uint32_t>(scene->meshes[iter].vertexData().size()),
+                        layout.indexOffset * sizeof(uint32_t),
+                        static_cast<uint32_t>(scene->meshes[iter].indexData().size()),
+                        layout.shortIndices ? vk::IndexType::eUint16 : vk::IndexType::eUint32,
+                        positions.data(),
+                        indexData.data(),
                         }));
+            }
 
-                instanceInfo.instanceCustomIndex = scene->meshes.size() + iter; // InstanceId
-                instanceInfo.accelerationStructureReference = vram.blases[vram.blases.size() - 1]->address();
+            vram.blases.push_back(blasBuilder->add({
+                    .positions = vram.lightPositions,
+                    .indices = vram.lightIndices,
+                    .commandPool = graphicsPool,
+                    .queue = graphicsQueue,
+                    .device = device,
+                    .allocator = allocator,
+                    .batch = uploads,
+                    .hostPositions = lightPadPositions.data(),
+                    .hostIndices = lightPadIndices.data(),
+                    .allowUpdate = params.animateLights,
+                    }));
+
+            blasBuilder->build();
+
+            // Compaction moves the BLASes, so their addresses are only final after it.
+            // Serializing for the next run needs the builds to have completed too.
+            uploads->flush();
+            blasBuilder->compact();
+            blasBuilder->store();
+            uploads = newUploads();
+
+            for (auto const& instance : scene->instances) {
+                // mergeStatic leaves no instances on the meshes it empties, but source meshes can be empty too
+                if (vram.blases[instance.mesh] == nullptr)
+                    continue;
+
+                instanceInfo.transform = vkTransform(instance.transform);
+                instanceInfo.instanceCustomIndex = instance.mesh; // InstanceId
+                instanceInfo.accelerationStructureReference = vram.blases[instance.mesh]->address();
                 instances.push_back(instanceInfo);
             }
 
+            // The pads are already in world space, hit shaders find the light through lightPrimitives
+            instanceInfo.transform = vkTransform(glm::mat4(1.0f));
+            instanceInfo.instanceCustomIndex = scene->meshes.size(); // InstanceId
+            instanceInfo.accelerationStructureReference = vram.blases.back()->address();
+            instances.push_back(instanceInfo);
+
             vram.lights = fillVRAMBuffer(vram_lights, vk::BufferUsageFlagBits::eStorageBuffer);
+            vram.lightAlias = fillVRAMBuffer(hd::Model_t::buildAliasTable(vram_lights), vk::BufferUsageFlagBits::eStorageBuffer);
+            vram.lightTree = fillVRAMBuffer(hd::Model_t::buildLightTree(vram_lights), vk::BufferUsageFlagBits::eStorageBuffer);
+
+            // Only the header when the grid is off, the descriptors still need a buffer
+            const vk::DeviceSize gridSamples = (params.regirCell > 0.0f) ? regirDim * regirDim * regirDim * regirSlots : 1;
+            vram.lightGrid = hd::conjure({
+                    .allocator = allocator,
+                    .size = sizeof(glm::vec4) + gridSamples * 3 * sizeof(float),
+                    .bufferUsage = vk::BufferUsageFlagBits::eStorageBuffer,
+                    .memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY,
+                    });
+
+            const vk::DeviceSize tileSamples = params.lightTiles ? lightTileCount * lightTileSize : 1;
+            vram.lightTiles = hd::conjure({
+                    .allocator = allocator,
+                    .size = sizeof(glm::uvec4) + tileSamples * tileSampleSize,
+                    .bufferUsage = vk::BufferUsageFlagBits::eStorageBuffer,
+                    .memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY,
+                    });
 
             auto instbuffer = fillVRAMBuffer(instances, vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR, VMA_MEMORY_USAGE_CPU_TO_GPU);
 
+            // Waits for the BLAS builds and the instance copy
+            uploads->barrier();
+
             vram.tlas = hd::conjure({
                     instbuffer,
                     graphicsPool,
                     graphicsQueue,
                     device,
                     allocator,
+                    uploads,
+                    params.animateLights,
                     });
 
+            // The batch keeps it alive until the build has completed
             instbuffer.reset();
 
+            if (params.animateLights) {
+                animatedLights.assign(lights.begin(), lights.end());
+
+                dynamicScene = hd::DynamicScene_t::conjure({
+                        .device = device,
+                        .allocator = allocator,
+                        .tlas = vram.tlas,
+                        .lights = vram.lights,
+                        .instances = std::move(instances),
+                        .lightProps = std::move(vram_lights),
+                        .lightBLAS = vram.blases.back(),
+                        .lightPositions = vram.lightPositions,
+                        .pad = std::move(unitPadPositions),
+                        .framesInFlight = MAX_FRAMES_IN_FLIGHT,
+                        });
+            }
+
             uniSizes.meshesSize = scene->meshes.size();
             uniSizes.lightsSize = lights.size();
             uniSizes.M = params.M;
+            uniSizes.useLightTree = params.lightTree;
+            uniSizes.useLightGrid = params.regirCell > 0.0f;
+            uniSizes.useLightTiles = params.lightTiles;
             if (params.multiply)
                 uniSizes.C = 1;
             else
@@ -295,9 +590,10 @@ class App {
                         .queue = graphicsQueue,
                         .allocator = allocator,
                         .device = device,
-                        .data = {dataStruct},
+                        .data = std::span<const T>(&dataStruct, 1),
                         .usage = vk::BufferUsageFlagBits::eUniformBuffer,
                         .memoryUsage = VMA_MEMORY_USAGE_CPU_TO_GPU,
+                        .batch = uploads,
                         });
             };
 
@@ -306,6 +602,8 @@ class App {
             allocVRAMUniBuffer(vram.uniFrames, {});
             allocVRAMUniBuffer(vram.uniMotion, {});
             allocVRAMUniBuffer(vram.uniSizes,  uniSizes);
+
+            uploads->flush();
         }
 
         constexpr auto selectFeatures() {
@@ -324,6 +622,7 @@ class App {
             } features;
 
             features.feats.samplerAnisotropy = true;
+            features.feats.textureCompressionBC = true;
 
             features.scalar_feats.scalarBlockLayout = true;
 
@@ -491,6 +790,23 @@ class App {
                 inFlightFences[iter] = hd::Fence_t::conjure({.device = device});
             }
 
+            threadPool = hd::ThreadPool_t::conjure({});
+
+            uploadStream = hd::UploadStream_t::conjure({
+                    .device = device,
+                    .allocator = allocator,
+                    .graphicsQueue = graphicsQueue,
+                    });
+
+            textureCache = hd::TextureCache_t::conjure({
+                    .commandPool = graphicsPool,
+                    .queue = graphicsQueue,
+                    .allocator = allocator,
+                    .device = device,
+                    .pool = threadPool,
+                    .rebuild = params.rebuildCache,
+                    });
+
             // BEGIN RAM
             /* std::vector<hd::Model> sceneModels; */
             /* sceneModels.reserve(2); */
@@ -509,24 +825,37 @@ class App {
             /*             }); */
             /* } */
 
-            auto scene = hd::conjure({
-                    "models/scene.obj",
-                    [&](const char *filename){
-                        return hd::conjure({
-                                filename,
-                                graphicsPool,
-                                graphicsQueue,
-                                allocator,
-                                device,
-                                }); },
-                    params.multiply,
+            auto sceneCache = hd::SceneCache_t::conjure({
+                    .filename = (params.multiply) ? "models/scene.100.hdscene" : "models/scene.hdscene",
+                    .modelFilename = "models/scene.obj",
+                    .lightsFilename = params.lights,
+                    .textures = textureCache,
+                    .multiply = params.multiply,
+                    .weld = params.weld,
+                    .rebuild = params.rebuildCache,
+                    .pool = threadPool,
                     });
 
-            auto lights = hd::Model_t::parseLights("models/scene.json", params.multiply);
+            auto scene = sceneCache->model();
+            auto lights = sceneCache->lights();
+
+            // After the cache, which keeps the meshes as authored
+            if (params.mergeStatic)
+                scene->mergeStatic({}, threadPool);
+
             // END RAM
 
+            // Textures cook and copy on the transfer queue while the geometry uploads and builds here,
+            // the first frame acquires them
+            auto texturesRecorded = uploadStream->enqueue([this](hd::UploadBatch batch) {
+                    textureCache->load(batch);
+                    });
+
             populateInitialVRAM(scene, lights);
 
+            texturesRecorded.get();
+            vram.diffuse = textureCache->textures();
+
             auto bind = [](uint32_t idx, vk::DescriptorType type, vk::ShaderStageFlags stages, uint32_t count = 1) {
                 vk::DescriptorSetLayoutBinding binding{};
                 binding.binding = idx;
@@ -548,13 +877,17 @@ class App {
                         bind(5, vk::DescriptorType::eStorageImage, vk::ShaderStageFlagBits::eCompute),
                         bind(6, vk::DescriptorType::eStorageImage, vk::ShaderStageFlagBits::eCompute),
                         bind(7, vk::DescriptorType::eStorageImage, vk::ShaderStageFlagBits::eCompute),
+                        bind(8, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute),
+                        bind(9, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute),
+                        bind(10, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute),
+                        bind(11, vk::DescriptorType::eStorageImage, vk::ShaderStageFlagBits::eCompute),
                     },
                     });
 
             vk::PushConstantRange pushWindowSize{};
             pushWindowSize.stageFlags = vk::ShaderStageFlagBits::eCompute;
             pushWindowSize.offset = 0;
-            pushWindowSize.size = sizeof(PushWindowSize);
+            pushWindowSize.size = sizeof(PushWindowSize) + sizeof(PushSpatialPass);
 
             compPipeLayout = hd::conjure({
                     .device = device,
@@ -586,6 +919,30 @@ class App {
                 .shaderInfo = spatialShader->info(),
             });
 
+            hd::Shader regirShader = hd::conjure({
+                    .device = device,
+                    .filename = "shaders/regir.comp.spv",
+                    .stage = vk::ShaderStageFlagBits::eCompute,
+                    });
+
+            regirPipeline = hd::conjure({
+                .pipelineLayout = compPipeLayout,
+                .device = device,
+                .shaderInfo = regirShader->info(),
+            });
+
+            hd::Shader lightTilesShader = hd::conjure({
+                    .device = device,
+                    .filename = "shaders/lighttiles.comp.spv",
+                    .stage = vk::ShaderStageFlagBits::eCompute,
+                    });
+
+            lightTilesPipeline = hd::conjure({
+                .pipelineLayout = compPipeLayout,
+                .device = device,
+                .shaderInfo = lightTilesShader->info(),
+            });
+
             rayLayout = hd::conjure({
                     .device = device,
                     .bindings = { 
@@ -593,9 +950,9 @@ class App {
                         bind(1, vk::DescriptorType::eStorageImage, vk::ShaderStageFlagBits::eRaygenKHR),
                         bind(2, vk::DescriptorType::eUniformBuffer, vk::ShaderStageFlagBits::eRaygenKHR),
                         bind(3, vk::DescriptorType::eCombinedImageSampler, vk::ShaderStageFlagBits::eClosestHitKHR, vram.diffuse.size()),
-                        bind(4, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eClosestHitKHR, vram.vertices.size()),
-                        bind(5, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eClosestHitKHR, vram.indices.size()),
-                        bind(6, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eClosestHitKHR, vram.materials.size()),
+                        bind(4, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eClosestHitKHR),
+                        bind(5, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eClosestHitKHR),
+                        bind(6, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eClosestHitKHR),
                         bind(7, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eClosestHitKHR),
                         bind(8, vk::DescriptorType::eUniformBuffer, vk::ShaderStageFlagBits::eClosestHitKHR),
                         bind(9, vk::DescriptorType::eStorageImage, vk::ShaderStageFlagBits::eClosestHitKHR),
@@ -604,6 +961,9 @@ class App {
                         bind(12, vk::DescriptorType::eStorageImage, vk::ShaderStageFlagBits::eClosestHitKHR),
                         bind(13, vk::DescriptorType::eStorageImage, vk::ShaderStageFlagBits::eClosestHitKHR),
                         bind(14, vk::DescriptorType::eUniformBuffer, vk::ShaderStageFlagBits::eClosestHitKHR),
+                        bind(15, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eClosestHitKHR),
+                        bind(16, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eClosestHitKHR),
+                        bind(17, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eClosestHitKHR),
                     },
                     });
 
@@ -639,10 +999,10 @@ class App {
 
         inline auto fillSpatialSet() {
             std::vector<std::variant<vk::DescriptorImageInfo, vk::DescriptorBufferInfo>> infos;
-            infos.reserve(8);
+            infos.reserve(12);
 
             std::vector<vk::WriteDescriptorSet> writes;
-            writes.reserve(8);
+            writes.reserve(12);
 
             auto write = [&](uint32_t binding, vk::DescriptorType type, uint32_t index = 0) {
                 vk::WriteDescriptorSet writeSet{};
@@ -679,6 +1039,10 @@ class App {
             fill(5, vram.reservoir.vnorm.view->writeInfo(vk::ImageLayout::eGeneral), vk::DescriptorType::eStorageImage);
             fill(6, vram.reservoir.vmat.view->writeInfo(vk::ImageLayout::eGeneral), vk::DescriptorType::eStorageImage);
             fill(7, vram.reservoir.past.view->writeInfo(vk::ImageLayout::eGeneral), vk::DescriptorType::eStorageImage);
+            fill(8, vram.lightAlias->writeInfo(), vk::DescriptorType::eStorageBuffer);
+            fill(9, vram.lightGrid->writeInfo(), vk::DescriptorType::eStorageBuffer);
+            fill(10, vram.lightTiles->writeInfo(), vk::DescriptorType::eStorageBuffer);
+            fill(11, vram.reservoir.spatial.view->writeInfo(vk::ImageLayout::eGeneral), vk::DescriptorType::eStorageImage);
 
             device->raw().updateDescriptorSets(writes, nullptr);
         }
@@ -726,10 +1090,10 @@ class App {
 
         inline auto fillRaySet() {
             std::vector<std::variant<vk::DescriptorImageInfo, vk::DescriptorBufferInfo, vk::WriteDescriptorSetAccelerationStructureKHR>> infos;
-            infos.reserve(12 + 4 * vram.vertices.size());
+            infos.reserve(18 + vram.diffuse.size());
 
             std::vector<vk::WriteDescriptorSet> writes;
-            writes.reserve(12 + 4 * vram.vertices.size());
+            writes.reserve(18 + vram.diffuse.size());
 
             auto write = [&](uint32_t binding, vk::DescriptorType type, uint32_t index = 0) {
                 vk::WriteDescriptorSet writeSet{};
@@ -776,13 +1140,16 @@ class App {
             fill(12, vram.reservoir.vmat.view->writeInfo(vk::ImageLayout::eGeneral), vk::DescriptorType::eStorageImage);
             fill(13, vram.reservoir.past.view->writeInfo(vk::ImageLayout::eGeneral), vk::DescriptorType::eStorageImage);
             fill(14, vram.uniMotion->writeInfo(), vk::DescriptorType::eUniformBuffer);
+            fill(15, vram.lightTree->writeInfo(), vk::DescriptorType::eStorageBuffer);
+            fill(16, vram.lightGrid->writeInfo(), vk::DescriptorType::eStorageBuffer);
+            fill(17, vram.lightTiles->writeInfo(), vk::DescriptorType::eStorageBuffer);
 
-            for (uint32_t iter = 0; iter < vram.vertices.size(); iter++) {
+            for (uint32_t iter = 0; iter < vram.diffuse.size(); iter++)
                 fill(3, vram.diffuse[iter]->writeInfo(vk::ImageLayout::eShaderReadOnlyOptimal), vk::DescriptorType::eCombinedImageSampler, iter);
-                fill(4, vram.vertices[iter]->writeInfo(), vk::DescriptorType::eStorageBuffer, iter);
-                fill(5, vram.indices[iter]->writeInfo(), vk::DescriptorType::eStorageBuffer, iter);
-                fill(6, vram.materials[iter]->writeInfo(), vk::DescriptorType::eStorageBuffer, iter);
-            }
+
+            fill(4, vram.geometries->writeInfo(), vk::DescriptorType::eStorageBuffer);
+            fill(5, vram.lightPrimitives->writeInfo(), vk::DescriptorType::eStorageBuffer);
+            fill(6, vram.lightAlias->writeInfo(), vk::DescriptorType::eStorageBuffer);
 
             device->raw().updateDescriptorSets(writes, nullptr);
         }
@@ -829,6 +1196,35 @@ class App {
 
             buffer->begin();
 
+            // Refill the light grid around the camera and the light tiles, earlier frames may still read them
+            if (params.regirCell > 0.0f || params.lightTiles) {
+                vk::MemoryBarrier read{};
+                read.srcAccessMask = vk::AccessFlagBits::eShaderRead;
+                read.dstAccessMask = vk::AccessFlagBits::eShaderWrite;
+
+                buffer->raw().pipelineBarrier(vk::PipelineStageFlagBits::eRayTracingShaderKHR, vk::PipelineStageFlagBits::eComputeShader,
+                        vk::DependencyFlags{0}, read, nullptr, nullptr);
+
+                buffer->raw().bindDescriptorSets(vk::PipelineBindPoint::eCompute, compPipeLayout->raw(), 0, spatialDescriptorSet->raw(), nullptr);
+
+                if (params.regirCell > 0.0f) {
+                    buffer->raw().bindPipeline(vk::PipelineBindPoint::eCompute, regirPipeline->raw());
+                    buffer->raw().dispatch((regirDim * regirDim * regirDim * regirSlots + 63) / 64, 1, 1);
+                }
+
+                if (params.lightTiles) {
+                    buffer->raw().bindPipeline(vk::PipelineBindPoint::eCompute, lightTilesPipeline->raw());
+                    buffer->raw().dispatch((lightTileCount * lightTileSize + 63) / 64, 1, 1);
+                }
+
+                vk::MemoryBarrier filled{};
+                filled.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+                filled.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+
+                buffer->raw().pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eRayTracingShaderKHR,
+                        vk::DependencyFlags{0}, filled, nullptr, nullptr);
+            }
+
             buffer->raw().bindPipeline(vk::PipelineBindPoint::eRayTracingKHR, rayPipeline->raw());
             buffer->raw().bindDescriptorSets(vk::PipelineBindPoint::eRayTracingKHR, rayPipeLayout->raw(), 0, rayDescriptorSet->raw(), nullptr);
 
@@ -870,6 +1266,12 @@ class App {
                     vk::AccessFlagBits::eMemoryRead
                     ),
                 make(vram.reservoir.past.image,
+                    vk::ImageLayout::eGeneral,
+                    vk::ImageLayout::eGeneral,
+                    vk::AccessFlagBits::eMemoryRead,
+                    vk::AccessFlagBits::eMemoryWrite
+                    ),
+                make(vram.reservoir.spatial.image,
                     vk::ImageLayout::eGeneral,
                     vk::ImageLayout::eGeneral,
                     vk::AccessFlagBits::eMemoryRead,
@@ -881,7 +1283,38 @@ class App {
 
             buffer->raw().bindDescriptorSets(vk::PipelineBindPoint::eCompute, compPipeLayout->raw(), 0, spatialDescriptorSet->raw(), nullptr);
             buffer->raw().bindPipeline(vk::PipelineBindPoint::eCompute, spatialPipeline->raw());
-            buffer->raw().dispatch(uint32_t(ceil(swapChain->extent().width / 16.0f)), uint32_t(ceil(swapChain->extent().height / 16.0f)), 1);
+
+            // Every pass reads what the previous one wrote, present and spatial take turns and the last pass writes past
+            uint32_t src = reservoirPresent;
+            for (uint32_t pass = 0; pass < params.spatialPasses; pass++) {
+                const bool last = (pass + 1 == params.spatialPasses);
+                const struct PushSpatialPass spatialPass = {
+                    pass,
+                    src,
+                    last ? reservoirPast : (src == reservoirPresent ? reservoirSpatial : reservoirPresent),
+                };
+
+                if (pass > 0)
+                    engage(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader,
+                        make(vram.reservoir.present.image,
+                            vk::ImageLayout::eGeneral,
+                            vk::ImageLayout::eGeneral,
+                            vk::AccessFlagBits::eMemoryRead | vk::AccessFlagBits::eMemoryWrite,
+                            vk::AccessFlagBits::eMemoryRead | vk::AccessFlagBits::eMemoryWrite
+                            ),
+                        make(vram.reservoir.spatial.image,
+                            vk::ImageLayout::eGeneral,
+                            vk::ImageLayout::eGeneral,
+                            vk::AccessFlagBits::eMemoryRead | vk::AccessFlagBits::eMemoryWrite,
+                            vk::AccessFlagBits::eMemoryRead | vk::AccessFlagBits::eMemoryWrite
+                            )
+                        );
+
+                buffer->raw().pushConstants(compPipeLayout->raw(), vk::ShaderStageFlagBits::eCompute, sizeof(PushWindowSize), sizeof(PushSpatialPass), &spatialPass);
+                buffer->raw().dispatch(uint32_t(ceil(swapChain->extent().width / 16.0f)), uint32_t(ceil(swapChain->extent().height / 16.0f)), 1);
+
+                src = spatialPass.dst;
+            }
 
             engage(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eRayTracingShaderKHR,
                 make(vram.reservoir.vpos.image,
@@ -925,11 +1358,12 @@ class App {
                     )
                 );
 
-            engage(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eTransfer,
+            // Spatial passes in between may have written present
+            engage(vk::PipelineStageFlagBits::eTransfer | vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eTransfer,
                 make(vram.reservoir.present.image,
                     vk::ImageLayout::eGeneral,
                     vk::ImageLayout::eTransferDstOptimal,
-                    vk::AccessFlagBits::eTransferRead,
+                    vk::AccessFlagBits::eTransferRead | vk::AccessFlagBits::eShaderWrite,
                     vk::AccessFlagBits::eTransferWrite
                     )
                 );
@@ -1211,6 +1645,7 @@ class App {
             allocWorkImage(vram.reservoir.vmat, vk::Format::eR32G32B32A32Sfloat, vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst, true);
             allocWorkImage(vram.reservoir.vpos, vk::Format::eR32G32B32A32Sfloat, vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst, true);
             allocWorkImage(vram.reservoir.past, vk::Format::eR32G32B32A32Sfloat, vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst, true);
+            allocWorkImage(vram.reservoir.spatial, vk::Format::eR32G32B32A32Sfloat, vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst, true);
 
             ram.saveImage = hd::conjure({
                     .allocator = allocator,
@@ -1281,6 +1716,8 @@ class App {
             vram.reservoir.vmat.view.reset();
             vram.reservoir.past.image.reset();
             vram.reservoir.past.view.reset();
+            vram.reservoir.spatial.image.reset();
+            vram.reservoir.spatial.view.reset();
             vram.storage.frame.view.reset();
             vram.storage.frame.image.reset();
             swapChain.reset();
@@ -1387,6 +1824,34 @@ class App {
             if (glfwGetKey(window->raw(), GLFW_KEY_K) == GLFW_PRESS)
                 rotateXAngle += -cameraRotateSpeed;
 
+            // Spatial reuse: , and . change the neighbours, [ and ] the radius, - and = the passes
+            static std::vector<bool> held(GLFW_KEY_LAST + 1, false);
+            auto tapped = [&](int key) {
+                const bool pressed = glfwGetKey(window->raw(), key) == GLFW_PRESS;
+                const bool tap = pressed && !held[key];
+                held[key] = pressed;
+                return tap;
+            };
+
+            if (tapped(GLFW_KEY_COMMA) && params.spatialNeighbors > 0)
+                std::cout << "Spatial neighbours: " << --params.spatialNeighbors << std::endl;
+            if (tapped(GLFW_KEY_PERIOD))
+                std::cout << "Spatial neighbours: " << ++params.spatialNeighbors << std::endl;
+            if (glfwGetKey(window->raw(), GLFW_KEY_LEFT_BRACKET) == GLFW_PRESS)
+                params.spatialRadius = std::max(params.spatialRadius * (1.0f - cameraRotateSpeed), 1.0f);
+            if (glfwGetKey(window->raw(), GLFW_KEY_RIGHT_BRACKET) == GLFW_PRESS)
+                params.spatialRadius = params.spatialRadius * (1.0f + cameraRotateSpeed);
+
+            // The pass count is recorded into the command buffers, they are rebuilt like after a resize
+            if (tapped(GLFW_KEY_MINUS) && params.spatialPasses > 1) {
+                std::cout << "Spatial passes: " << --params.spatialPasses << std::endl;
+                framebufferResized = true;
+            }
+            if (tapped(GLFW_KEY_EQUAL)) {
+                std::cout << "Spatial passes: " << ++params.spatialPasses << std::endl;
+                framebufferResized = true;
+            }
+
 
             const UniCount uniCount{
                 .count = (globalFrameCount == params.frames) ? (params.frames - (params.tolerance)) : 1,
@@ -1398,6 +1863,9 @@ class App {
                 .lightsSize = uniSizes.lightsSize,
                 .frames = globalFrameCount,
                 .cameraPos = glm::vec3(uniData.viewInverse[3]),
+                .gridCellSize = params.regirCell,
+                .spatialNeighbors = params.spatialNeighbors,
+                .spatialRadius = params.spatialRadius,
             };
             /* std::cout << uniFrames.cameraPos[0] << ' ' << uniFrames.cameraPos[1] << ' ' << uniFrames.cameraPos[2] << std::endl; */
 
@@ -1425,6 +1893,20 @@ class App {
             /* std::cout << rotateXAngle << ' ' << rotateYAngle << ' ' << rotateZAngle << std::endl; */
         }
 
+        // Lights bob along their normal, every frame refits the TLAS
+        void animateScene() {
+            static auto startTime = std::chrono::high_resolution_clock::now();
+            const float time = std::chrono::duration<float, std::chrono::seconds::period>(std::chrono::high_resolution_clock::now() - startTime).count();
+
+            for (uint32_t iter = 0; iter < animatedLights.size(); iter++) {
+                auto light = animatedLights[iter];
+                const glm::vec3 normal = glm::mat3_cast(glm::normalize(glm::quat(light.rotate)))[1];
+                light.pos += normal * (0.5f * glm::sin(time + 0.37f * iter));
+
+                dynamicScene->setLight(iter, light);
+            }
+        }
+
         uint32_t currentFrame = 0;
         void update() {
             static uint32_t screenshotFrame = -1;
@@ -1458,11 +1940,26 @@ class App {
             inFlightImages[imageIndex] = inFlightFences[currentFrame];
 
             {
-                vk::Semaphore waitSemaphores[] = { imageAvailable[currentFrame]->raw() };
-                vk::PipelineStageFlags waitStages[] = { vk::PipelineStageFlagBits::eColorAttachmentOutput };
                 vk::Semaphore signalSemaphores[] = { renderFinished[currentFrame]->raw() };
 
+                hd::UploadAcquire acquire;
+                uploadStream->acquire(acquire, inFlightFences[currentFrame]);
+
+                std::vector<vk::Semaphore> waitSemaphores = { imageAvailable[currentFrame]->raw() };
+                std::vector<vk::PipelineStageFlags> waitStages = { vk::PipelineStageFlagBits::eColorAttachmentOutput };
+                waitSemaphores.insert(waitSemaphores.end(), acquire.semaphores.begin(), acquire.semaphores.end());
+                waitStages.insert(waitStages.end(), acquire.stages.begin(), acquire.stages.end());
+
                 std::vector<vk::CommandBuffer> raw;
+                if (acquire.commandBuffer != nullptr)
+                    raw.push_back(acquire.commandBuffer->raw());
+
+                if (dynamicScene != nullptr) {
+                    animateScene();
+
+                    if (auto sceneCmd = dynamicScene->record(currentFrame); sceneCmd != nullptr)
+                        raw.push_back(sceneCmd->raw());
+                }
 
                 if ((globalFrameCount == params.frames) && params.capture) {
                     raw.push_back(rayCmdBuffers[imageIndex]->raw());
@@ -1475,9 +1972,9 @@ class App {
                     raw.push_back(rayCmdBuffers[imageIndex]->raw());
 
                 vk::SubmitInfo submitInfo = {};
-                submitInfo.waitSemaphoreCount = 1;
-                submitInfo.pWaitSemaphores = waitSemaphores;
-                submitInfo.pWaitDstStageMask = waitStages;
+                submitInfo.waitSemaphoreCount = waitSemaphores.size();
+                submitInfo.pWaitSemaphores = waitSemaphores.data();
+                submitInfo.pWaitDstStageMask = waitStages.data();
                 submitInfo.commandBufferCount = raw.size();
                 submitInfo.pCommandBuffers = raw.data();
                 submitInfo.signalSemaphoreCount = 1;
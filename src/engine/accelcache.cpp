@@ -0,0 +1,121 @@
+#include <accelcache.hpp>
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <cstring>
+
+namespace hd {
+    static constexpr char accelCacheMagic[8] = { 'H', 'D', 'A', 'C', 'C', 'E', 'L', '\0' };
+
+    AccelCache_t::AccelCache_t(AccelCacheCreateInfo const & ci) {
+        _filename = ci.filename;
+        _device = ci.device;
+        _rebuild = ci.rebuild;
+    }
+
+    std::vector<std::span<const std::byte>> AccelCache_t::load(uint64_t key, size_t count) {
+        _file.reset();
+
+        if (_rebuild || !std::filesystem::exists(_filename))
+            return {};
+
+        try {
+            _file = hd::conjure(MappedFileCreateInfo{ .filename = _filename });
+        } catch (std::exception const & e) {
+            std::cerr << "Acceleration structure cache " << _filename << " is unreadable: " << e.what() << std::endl;
+            return {};
+        }
+
+        if (_file->size() < sizeof(AccelCacheHeader))
+            return {};
+
+        auto header = _file->at<AccelCacheHeader>(0);
+        if (memcmp(header->magic, accelCacheMagic, sizeof(accelCacheMagic)) != 0
+                || header->version != version
+                || header->key != key
+                || header->count != count
+                || header->fileSize != _file->size()
+                || (_file->size() - sizeof(AccelCacheHeader)) / sizeof(AccelCacheBlob) < count)
+            return {};
+
+        auto records = _file->at<AccelCacheBlob>(sizeof(AccelCacheHeader));
+
+        std::vector<std::span<const std::byte>> blobs;
+        blobs.reserve(count);
+
+        for (size_t iter = 0; iter < count; iter++) {
+            auto const & record = records[iter];
+
+            // Every blob starts with the driver UUID and the compatibility UUID
+            if (record.offset > _file->size() || record.size > _file->size() - record.offset || record.size < 2 * VK_UUID_SIZE)
+                return {};
+
+            blobs.emplace_back(_file->at<std::byte>(record.offset), record.size);
+        }
+
+        // One driver wrote all of them, checking the first is enough
+        if (!blobs.empty()) {
+            vk::AccelerationStructureVersionInfoKHR versionInfo{};
+            versionInfo.pVersionData = reinterpret_cast<const uint8_t*>(blobs.front().data());
+
+            if (_device->raw().getAccelerationStructureCompatibilityKHR(versionInfo) != vk::AccelerationStructureCompatibilityKHR::eCompatible) {
+                std::cerr << "Acceleration structure cache " << _filename << " was written by an incompatible driver, rebuilding" << std::endl;
+                return {};
+            }
+        }
+
+        return blobs;
+    }
+
+    void AccelCache_t::store(uint64_t key, std::vector<std::span<const std::byte>> const & blobs) {
+        auto align = [](uint64_t offset) {
+            return (offset + blobAlignment - 1) & ~uint64_t(blobAlignment - 1);
+        };
+
+        // A mapping of the old file may still be read from
+        _file.reset();
+
+        AccelCacheHeader header{};
+        memcpy(header.magic, accelCacheMagic, sizeof(accelCacheMagic));
+        header.version = version;
+        header.count = blobs.size();
+        header.key = key;
+
+        std::vector<AccelCacheBlob> records(blobs.size());
+
+        uint64_t offset = sizeof(AccelCacheHeader) + sizeof(AccelCacheBlob) * records.size();
+        for (size_t iter = 0; iter < blobs.size(); iter++) {
+            records[iter].offset = offset = align(offset);
+            records[iter].size = blobs[iter].size();
+            offset += blobs[iter].size();
+        }
+
+        header.fileSize = offset;
+
+        // Write into a sibling file and swap it in, so a crashed run never leaves a torn cache behind
+        auto temporary = std::filesystem::path(_filename).concat(".tmp");
+        std::ofstream file(temporary, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            std::cerr << "Couldn't write acceleration structure cache " << _filename << std::endl;
+            return;
+        }
+
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(records.data()), sizeof(AccelCacheBlob) * records.size());
+
+        for (size_t iter = 0; iter < blobs.size(); iter++) {
+            static const char zeroes[blobAlignment] = {};
+            uint64_t position = file.tellp();
+            file.write(zeroes, records[iter].offset - position);
+            file.write(reinterpret_cast<const char*>(blobs[iter].data()), blobs[iter].size());
+        }
+
+        file.close();
+
+        std::error_code error;
+        std::filesystem::rename(temporary, _filename, error);
+        if (error)
+            std::cerr << "Couldn't write acceleration structure cache " << _filename << ": " << error.message() << std::endl;
+    }
+}
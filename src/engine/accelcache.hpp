@@ -0,0 +1,72 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <hdvw/device.hpp>
+
+#include <engine/mappedfile.hpp>
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <span>
+#include <vector>
+
+namespace hd {
+    // Serialized acceleration structures, every offset is relative to the start of the file:
+    //   AccelCacheHeader
+    //   AccelCacheBlob[count]
+    //   blobs, each one starting on a 256 byte boundary
+    struct AccelCacheHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t count;
+        uint64_t key; // Geometry and build flags of the structures
+        uint64_t fileSize;
+    };
+
+    struct AccelCacheBlob {
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    struct AccelCacheCreateInfo {
+        std::string_view filename;
+        Device device;
+        bool rebuild = false; // Never loads, store() still writes
+    };
+
+    class AccelCache_t;
+    typedef std::shared_ptr<AccelCache_t> AccelCache;
+
+    // Keeps serialized structures between runs. Blobs start with the driver and compatibility UUIDs,
+    // a device that can't deserialize them makes load() miss.
+    class AccelCache_t {
+        private:
+            static constexpr uint32_t version = 1;
+
+            std::string _filename;
+            Device _device;
+            bool _rebuild;
+
+            MappedFile _file;
+
+        public:
+            static constexpr vk::DeviceSize blobAlignment = 256; // Copies from and to memory need it
+
+            static AccelCache conjure(AccelCacheCreateInfo const & ci) {
+                return std::make_shared<AccelCache_t>(ci);
+            }
+
+            AccelCache_t(AccelCacheCreateInfo const & ci);
+
+            // Blobs stored under key, empty when missing, stale or incompatible. They stay mapped until the next load().
+            std::vector<std::span<const std::byte>> load(uint64_t key, size_t count);
+
+            void store(uint64_t key, std::vector<std::span<const std::byte>> const & blobs);
+    };
+
+    inline AccelCache conjure(AccelCacheCreateInfo const & ci) {
+        return AccelCache_t::conjure(ci);
+    }
+}
@@ -1,38 +1,68 @@
 #include <blas.hpp>
 
+#include <string_view>
+#include <functional>
+#include <algorithm>
+
 namespace hd {
     BLAS_t::BLAS_t(BLASCreateInfo const & ci) {
          _device = ci.device->raw();
          _allocator = ci.allocator;
 
+        const uint32_t vertexCount = (ci.vertexCount != 0) ? ci.vertexCount : ci.positions->count() - ci.firstVertex;
+        const uint32_t indexCount = (ci.indexCount != 0) ? ci.indexCount : ci.indices->count();
+
         // BLAS
         vk::AccelerationStructureGeometryTrianglesDataKHR triangles{};
         triangles.vertexFormat = vk::Format::eR32G32B32Sfloat;
-        triangles.vertexData = ci.vertices->address().deviceAddress;
-        triangles.maxVertex = ci.vertices->size();
-        triangles.vertexStride = sizeof(Vertex);
-        triangles.indexType = vk::IndexType::eUint32;
-        triangles.indexData = ci.indices->address().deviceAddress;
-        triangles.vertexStride = sizeof(Vertex);
-
-        vk::AccelerationStructureGeometryKHR aStructGeometry{};
-        aStructGeometry.flags = vk::GeometryFlagBitsKHR::eOpaque;
-        aStructGeometry.geometryType = vk::GeometryTypeKHR::eTriangles;
-        aStructGeometry.geometry.triangles = triangles;
+        triangles.vertexData = ci.positions->address().deviceAddress + ci.firstVertex * sizeof(glm::vec3);
+        triangles.maxVertex = vertexCount - 1;
+        triangles.vertexStride = sizeof(glm::vec3);
+        triangles.indexType = ci.indexType;
+        triangles.indexData = ci.indices->address().deviceAddress + ci.indexOffset;
+
+        _vertexAddress = triangles.vertexData.deviceAddress;
+        _indexAddress = triangles.indexData.deviceAddress;
+
+        _hostVertices = (ci.hostPositions != nullptr) ? ci.hostPositions + ci.firstVertex : nullptr;
+        _hostIndices = (ci.hostIndices != nullptr) ? static_cast<const char*>(ci.hostIndices) + ci.indexOffset : nullptr;
+        _vertexBytes = sizeof(glm::vec3) * vertexCount;
+        _indexBytes = ((ci.indexType == vk::IndexType::eUint16) ? sizeof(uint16_t) : sizeof(uint32_t)) * indexCount;
+
+        if (ci.hostBuild) {
+            if (ci.hostPositions == nullptr || ci.hostIndices == nullptr)
+                throw std::runtime_error("Host BLAS builds need host positions and indices");
+
+            triangles.vertexData.hostAddress = ci.hostPositions + ci.firstVertex;
+            triangles.indexData.hostAddress = static_cast<const char*>(ci.hostIndices) + ci.indexOffset;
+        }
+
+        _geometry = vk::AccelerationStructureGeometryKHR{};
+        _geometry.flags = vk::GeometryFlagBitsKHR::eOpaque;
+        _geometry.geometryType = vk::GeometryTypeKHR::eTriangles;
+        _geometry.geometry.triangles = triangles;
+
+        _flags = vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace;
+        if (ci.allowCompaction)
+            _flags |= vk::BuildAccelerationStructureFlagBitsKHR::eAllowCompaction;
+        if (ci.allowUpdate)
+            _flags |= vk::BuildAccelerationStructureFlagBitsKHR::eAllowUpdate;
 
         vk::AccelerationStructureBuildGeometryInfoKHR aStructGeometryBI{};
         aStructGeometryBI.type = vk::AccelerationStructureTypeKHR::eBottomLevel;
-        aStructGeometryBI.flags = vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace;
-        aStructGeometryBI.setGeometries(aStructGeometry);
+        aStructGeometryBI.flags = _flags;
+        aStructGeometryBI.setGeometries(_geometry);
 
         vk::AccelerationStructureBuildSizesInfoKHR aStructSizesBI = _device.getAccelerationStructureBuildSizesKHR(
-                vk::AccelerationStructureBuildTypeKHR::eDevice, aStructGeometryBI, ci.indices->count() / 3);
+                ci.hostBuild ? vk::AccelerationStructureBuildTypeKHR::eHost : vk::AccelerationStructureBuildTypeKHR::eDevice,
+                aStructGeometryBI, indexCount / 3);
 
         vk::BufferCreateInfo bufferCI{};
         bufferCI.size = aStructSizesBI.accelerationStructureSize;
         bufferCI.usage = vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress;
 
-        memory = _allocator->create(bufferCI, VMA_MEMORY_USAGE_GPU_ONLY);
+        // Host builds write the structure through a host mapping
+        memory = _allocator->create(bufferCI, ci.hostBuild ? VMA_MEMORY_USAGE_CPU_TO_GPU : VMA_MEMORY_USAGE_GPU_ONLY);
 
         vk::AccelerationStructureCreateInfoKHR aStructCI{};
         aStructCI.buffer = memory.buffer;
@@ -40,55 +70,196 @@ namespace hd {
         aStructCI.type = vk::AccelerationStructureTypeKHR::eBottomLevel;
 
         _aStruct = _device.createAccelerationStructureKHR(aStructCI, nullptr);
+        _size = aStructSizesBI.accelerationStructureSize;
+
+        vk::AccelerationStructureDeviceAddressInfoKHR aDeviceAddressInfo{};
+        aDeviceAddressInfo.accelerationStructure = _aStruct;
+
+        _aAddress = _device.getAccelerationStructureAddressKHR(aDeviceAddressInfo);
+
+        _range = vk::AccelerationStructureBuildRangeInfoKHR{};
+        _range.primitiveCount = indexCount / 3;
+        _range.primitiveOffset = 0x0;
+        _range.firstVertex = 0;
+        _range.transformOffset = 0x0;
+
+        _scratchSize = aStructSizesBI.buildScratchSize;
+
+        // Updates run on the device, so their scratch is sized for it
+        if (ci.allowUpdate) {
+            auto updateSizes = ci.hostBuild ? _device.getAccelerationStructureBuildSizesKHR(vk::AccelerationStructureBuildTypeKHR::eDevice,
+                    aStructGeometryBI, indexCount / 3) : aStructSizesBI;
+
+            vk::BufferCreateInfo updateCI{};
+            updateCI.size = std::max<vk::DeviceSize>(updateSizes.updateScratchSize, 1);
+            updateCI.usage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress;
 
-        // Scratch
+            _updateScratch = _allocator->create(updateCI, VMA_MEMORY_USAGE_GPU_ONLY);
+
+            vk::BufferDeviceAddressInfo updateAI{};
+            updateAI.buffer = _updateScratch.buffer;
+
+            _updateScratchAddress = _device.getBufferAddress(updateAI);
+        }
+
+        if (ci.deferred)
+            return;
+
+        const bool onHost = (ci.batch == nullptr) && ci.device->_aStructFeatures.accelerationStructureHostCommands;
+
+        // Scratch, only host builds need it visible to the host
         vk::BufferCreateInfo scratchCI{};
-        scratchCI.size = aStructSizesBI.buildScratchSize;
+        scratchCI.size = _scratchSize;
         scratchCI.usage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress;
 
-        auto scratch = _allocator->create(scratchCI, VMA_MEMORY_USAGE_CPU_TO_GPU);
+        auto scratch = _allocator->create(scratchCI, onHost ? VMA_MEMORY_USAGE_CPU_TO_GPU : VMA_MEMORY_USAGE_GPU_ONLY);
 
         vk::BufferDeviceAddressInfo scratchAI{};
         scratchAI.buffer = scratch.buffer;
 
-        auto scratchAdress = _device.getBufferAddress(scratchAI);
-
-        // Build
-        vk::AccelerationStructureBuildGeometryInfoKHR aStructGeometryBI2{};
-        aStructGeometryBI2.type = vk::AccelerationStructureTypeKHR::eBottomLevel;
-        aStructGeometryBI2.flags = vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace;
-        aStructGeometryBI2.mode = vk::BuildAccelerationStructureModeKHR::eBuild;
-        aStructGeometryBI2.dstAccelerationStructure = _aStruct;
-        aStructGeometryBI2.setGeometries(aStructGeometry);
-        aStructGeometryBI2.scratchData.deviceAddress = scratchAdress;
+        auto aStructGeometryBI2 = buildInfo(_device.getBufferAddress(scratchAI));
 
-        vk::AccelerationStructureBuildRangeInfoKHR aRangeBI{};
-        aRangeBI.primitiveCount = ci.indices->count() / 3;
-        aRangeBI.primitiveOffset = 0x0;
-        aRangeBI.firstVertex = 0;
-        aRangeBI.transformOffset = 0x0;
-
-        if (ci.device->_aStructFeatures.accelerationStructureHostCommands) {
+        if (ci.batch != nullptr) {
+            // Inputs are only resident once the batch completes, so the build has to go through it too
+            ci.batch->commandBuffer()->raw().buildAccelerationStructuresKHR(aStructGeometryBI2, &_range);
+        } else if (onHost) {
             // Implementation supports building acceleration structure building on host
-            if (_device.buildAccelerationStructuresKHR(nullptr, aStructGeometryBI2, &aRangeBI) != vk::Result::eSuccess)
+            if (_device.buildAccelerationStructuresKHR(nullptr, aStructGeometryBI2, &_range) != vk::Result::eSuccess)
                 throw std::runtime_error("Unable to create BLAS");
         } else {
             // Acceleration structure needs to be build on the device
             auto cmd = ci.commandPool->singleTimeBegin();
-            cmd->raw().buildAccelerationStructuresKHR(aStructGeometryBI2, &aRangeBI);
+            cmd->raw().buildAccelerationStructuresKHR(aStructGeometryBI2, &_range);
             ci.commandPool->singleTimeEnd(cmd, ci.queue);
         }
 
+        // Cleanup
+        if (ci.batch != nullptr) {
+            auto allocator = _allocator;
+            ci.batch->onComplete([allocator, scratch]() {
+                allocator->destroy(scratch.buffer, scratch.allocation);
+            });
+        } else {
+            _allocator->destroy(scratch.buffer, scratch.allocation);
+        }
+
+        releaseHostInputs();
+    }
+
+    vk::AccelerationStructureBuildGeometryInfoKHR BLAS_t::buildInfo(vk::DeviceAddress scratch) {
+        vk::AccelerationStructureBuildGeometryInfoKHR aStructGeometryBI{};
+        aStructGeometryBI.type = vk::AccelerationStructureTypeKHR::eBottomLevel;
+        aStructGeometryBI.flags = _flags;
+        aStructGeometryBI.mode = vk::BuildAccelerationStructureModeKHR::eBuild;
+        aStructGeometryBI.dstAccelerationStructure = _aStruct;
+        aStructGeometryBI.setGeometries(_geometry);
+        aStructGeometryBI.scratchData.deviceAddress = scratch;
+
+        return aStructGeometryBI;
+    }
+
+    void BLAS_t::update(CommandBuffer cmd) {
+        if (!_updateScratch.buffer)
+            throw std::runtime_error("BLAS was not created with allowUpdate");
+
+        auto geometry = _geometry;
+        geometry.geometry.triangles.vertexData.deviceAddress = _vertexAddress;
+        geometry.geometry.triangles.indexData.deviceAddress = _indexAddress;
+
+        vk::AccelerationStructureBuildGeometryInfoKHR aStructGeometryBI{};
+        aStructGeometryBI.type = vk::AccelerationStructureTypeKHR::eBottomLevel;
+        aStructGeometryBI.flags = _flags;
+        aStructGeometryBI.mode = vk::BuildAccelerationStructureModeKHR::eUpdate;
+        aStructGeometryBI.srcAccelerationStructure = _aStruct;
+        aStructGeometryBI.dstAccelerationStructure = _aStruct;
+        aStructGeometryBI.setGeometries(geometry);
+        aStructGeometryBI.scratchData.deviceAddress = _updateScratchAddress;
+
+        cmd->raw().buildAccelerationStructuresKHR(aStructGeometryBI, &_range);
+    }
+
+    uint64_t BLAS_t::inputHash() {
+        if (_hostVertices == nullptr || _hostIndices == nullptr)
+            return 0;
+
+        std::hash<std::string_view> hasher;
+        auto combine = [](uint64_t seed, uint64_t value) {
+            return seed ^ (value + 0x9E3779B97F4A7C15ull + (seed << 6) + (seed >> 2));
+        };
+
+        uint64_t ret = hasher(std::string_view(static_cast<const char*>(_hostVertices), _vertexBytes));
+        ret = combine(ret, hasher(std::string_view(static_cast<const char*>(_hostIndices), _indexBytes)));
+        ret = combine(ret, _indexBytes / std::max<size_t>(_range.primitiveCount * 3, 1)); // Index width
+        ret = combine(ret, static_cast<uint32_t>(_flags));
+
+        return ret;
+    }
+
+    void BLAS_t::releaseHostInputs() {
+        _hostVertices = nullptr;
+        _hostIndices = nullptr;
+
+        // Host builds pointed the geometry at the host copies
+        _geometry.geometry.triangles.vertexData.deviceAddress = _vertexAddress;
+        _geometry.geometry.triangles.indexData.deviceAddress = _indexAddress;
+    }
+
+    vk::AccelerationStructureBuildGeometryInfoKHR BLAS_t::buildInfo(void* scratch) {
+        auto aStructGeometryBI = buildInfo(vk::DeviceAddress(0));
+        aStructGeometryBI.scratchData.hostAddress = scratch;
+
+        return aStructGeometryBI;
+    }
+
+    void BLAS_t::compact(CommandBuffer cmd, vk::DeviceSize compactedSize) {
+        releaseRetired();
+
+        vk::BufferCreateInfo bufferCI{};
+        bufferCI.size = compactedSize;
+        bufferCI.usage = vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress;
+
+        auto compacted = _allocator->create(bufferCI, VMA_MEMORY_USAGE_GPU_ONLY);
+
+        vk::AccelerationStructureCreateInfoKHR aStructCI{};
+        aStructCI.buffer = compacted.buffer;
+        aStructCI.size = compactedSize;
+        aStructCI.type = vk::AccelerationStructureTypeKHR::eBottomLevel;
+
+        auto aStruct = _device.createAccelerationStructureKHR(aStructCI, nullptr);
+
+        vk::CopyAccelerationStructureInfoKHR copyInfo{};
+        copyInfo.src = _aStruct;
+        copyInfo.dst = aStruct;
+        copyInfo.mode = vk::CopyAccelerationStructureModeKHR::eCompact;
+
+        cmd->raw().copyAccelerationStructureKHR(copyInfo);
+
+        _retiredStruct = _aStruct;
+        _retiredMemory = memory;
+
+        _aStruct = aStruct;
+        memory = compacted;
+        _size = compactedSize;
+
         vk::AccelerationStructureDeviceAddressInfoKHR aDeviceAddressInfo{};
         aDeviceAddressInfo.accelerationStructure = _aStruct;
 
         _aAddress = _device.getAccelerationStructureAddressKHR(aDeviceAddressInfo);
+    }
 
-        // Cleanup
-        _allocator->destroy(scratch.buffer, scratch.allocation);
+    void BLAS_t::releaseRetired() {
+        if (!_retiredStruct)
+            return;
+
+        _device.destroyAccelerationStructureKHR(_retiredStruct);
+        _allocator->destroy(_retiredMemory.buffer, _retiredMemory.allocation);
+        _retiredStruct = nullptr;
     }
 
     BLAS_t::~BLAS_t() {
+        releaseRetired();
+        if (_updateScratch.buffer)
+            _allocator->destroy(_updateScratch.buffer, _updateScratch.allocation);
         _device.destroyAccelerationStructureKHR(_aStruct);
         _allocator->destroy(memory.buffer, memory.allocation);
     }
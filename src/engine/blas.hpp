@@ -11,12 +11,27 @@
 
 namespace hd {
     struct BLASCreateInfo {
-        DataBuffer<Vertex> vertices;
+        DataBuffer<glm::vec3> positions;
         DataBuffer<uint32_t> indices;
         CommandPool commandPool;
         Queue queue;
         Device device;
         Allocator allocator;
+        UploadBatch batch = nullptr; // Inputs must be made visible with batch->barrier() first
+        // Range of a mesh inside shared buffers, 0 counts build from the whole buffers with 32 bit indices
+        uint32_t firstVertex = 0;
+        uint32_t vertexCount = 0;
+        vk::DeviceSize indexOffset = 0; // In bytes
+        uint32_t indexCount = 0;
+        vk::IndexType indexType = vk::IndexType::eUint32;
+        // Host copies of positions and indices with the same layout, read by host builds and hashed by
+        // BLASBuilder caches until the build is done
+        const glm::vec3* hostPositions = nullptr;
+        const void* hostIndices = nullptr;
+        bool deferred = false; // Only creates the structure, a BLASBuilder records the build
+        bool allowCompaction = false;
+        bool hostBuild = false; // Sized for the host and kept in host visible memory, a BLASBuilder builds it
+        bool allowUpdate = false; // Keeps a scratch for update()
     };
 
     class BLAS_t;
@@ -29,6 +44,26 @@ namespace hd {
             vk::AccelerationStructureKHR _aStruct;
             vk::DeviceAddress _aAddress;
             ReturnBuffer memory;
+            vk::DeviceSize _size;
+            vk::BuildAccelerationStructureFlagsKHR _flags;
+
+            // Pre-compaction structure, freed by releaseRetired()
+            vk::AccelerationStructureKHR _retiredStruct;
+            ReturnBuffer _retiredMemory{};
+
+            vk::AccelerationStructureGeometryKHR _geometry;
+            vk::AccelerationStructureBuildRangeInfoKHR _range;
+            vk::DeviceSize _scratchSize;
+
+            vk::DeviceAddress _vertexAddress;
+            vk::DeviceAddress _indexAddress;
+            ReturnBuffer _updateScratch{};
+            vk::DeviceAddress _updateScratchAddress = 0;
+
+            const void* _hostVertices;
+            const void* _hostIndices;
+            size_t _vertexBytes;
+            size_t _indexBytes;
 
         public:
             static BLAS conjure(BLASCreateInfo const & ci) {
@@ -45,6 +80,39 @@ namespace hd {
                 return _aAddress;
             }
 
+            // The returned info points into this BLAS, it has to outlive the build call
+            vk::AccelerationStructureBuildGeometryInfoKHR buildInfo(vk::DeviceAddress scratch);
+
+            // Same for host builds, the geometry then points at the host copies
+            vk::AccelerationStructureBuildGeometryInfoKHR buildInfo(void* scratch);
+
+            inline auto const & range() {
+                return _range;
+            }
+
+            inline auto scratchSize() {
+                return _scratchSize;
+            }
+
+            inline auto size() {
+                return _size;
+            }
+
+            // Records a refit after the positions moved, topology has to stay the same. Needs allowUpdate.
+            void update(CommandBuffer cmd);
+
+            // Hash of the geometry and build flags, 0 without host copies of the inputs
+            uint64_t inputHash();
+
+            // Forgets the host copies of the inputs, they usually don't outlive the build. inputHash() returns 0 afterwards.
+            void releaseHostInputs();
+
+            // Records a compacting copy into cmd and switches to the copy, address() changes with it.
+            // The original stays alive until releaseRetired(), after cmd has completed.
+            void compact(CommandBuffer cmd, vk::DeviceSize compactedSize);
+
+            void releaseRetired();
+
             ~BLAS_t();
     };
 
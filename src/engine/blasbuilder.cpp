@@ -0,0 +1,473 @@
+#include <blasbuilder.hpp>
+
+#include <iostream>
+#include <algorithm>
+#include <thread>
+#include <cstddef>
+#include <cstring>
+
+namespace hd {
+    BLASBuilder_t::BLASBuilder_t(BLASBuilderCreateInfo const & ci) {
+        _commandPool = ci.commandPool;
+        _queue = ci.queue;
+        _device = ci.device;
+        _allocator = ci.allocator;
+        _batch = ci.batch;
+        _scratchBudget = ci.scratchBudget;
+        _onHost = ci.onHost && ci.device->_aStructFeatures.accelerationStructureHostCommands;
+        _compact = ci.compact && !_onHost;
+        _pool = ci.pool;
+        _cache = ci.cache;
+    }
+
+    BLAS BLASBuilder_t::add(BLASCreateInfo ci) {
+        ci.deferred = true;
+        ci.allowCompaction = _compact;
+        ci.hostBuild = _onHost;
+
+        _pending.push_back(BLAS_t::conjure(ci));
+        return _pending.back();
+    }
+
+    std::vector<size_t> BLASBuilder_t::runs(vk::DeviceSize alignment, vk::DeviceSize& scratchSize) {
+        auto align = [alignment](vk::DeviceSize size) {
+            return (size + alignment - 1) / alignment * alignment;
+        };
+
+        // A build larger than the budget runs alone
+        std::vector<size_t> runs = { 0 };
+        vk::DeviceSize used = 0;
+        scratchSize = 0;
+
+        for (size_t iter = 0; iter < _pending.size(); iter++) {
+            auto size = align(_pending[iter]->scratchSize());
+
+            if (used + size > _scratchBudget && iter > runs.back()) {
+                runs.push_back(iter);
+                used = 0;
+            }
+
+            used += size;
+            scratchSize = std::max(scratchSize, used);
+        }
+        runs.push_back(_pending.size());
+
+        return runs;
+    }
+
+    void BLASBuilder_t::buildOnHost() {
+        auto device = _device->raw();
+
+        const vk::DeviceSize alignment = std::max(1u, _device->_aStructProperties.minAccelerationStructureScratchOffsetAlignment);
+        auto align = [alignment](vk::DeviceSize size) {
+            return (size + alignment - 1) / alignment * alignment;
+        };
+
+        vk::DeviceSize scratchSize;
+        auto runs = this->runs(alignment, scratchSize);
+
+        std::vector<std::byte> scratch(scratchSize + alignment);
+        auto base = reinterpret_cast<std::byte*>(align(reinterpret_cast<uintptr_t>(scratch.data())));
+
+        for (size_t run = 0; run + 1 < runs.size(); run++) {
+            std::vector<vk::DeferredOperationKHR> operations;
+            std::vector<vk::DeferredOperationKHR> joins; // One entry per thread that may work on the operation
+
+            // Deferred operations read their parameters until they complete, so the infos must not move until then
+            std::vector<vk::AccelerationStructureBuildGeometryInfoKHR> infos;
+            infos.reserve(runs[run + 1] - runs[run]);
+
+            vk::DeviceSize offset = 0;
+            for (size_t iter = runs[run]; iter < runs[run + 1]; iter++) {
+                infos.push_back(_pending[iter]->buildInfo(static_cast<void*>(base + offset)));
+                auto range = &_pending[iter]->range();
+                offset += align(_pending[iter]->scratchSize());
+
+                auto operation = device.createDeferredOperationKHR();
+                auto result = device.buildAccelerationStructuresKHR(operation, infos.back(), range);
+
+                if (result == vk::Result::eOperationNotDeferredKHR || result == vk::Result::eSuccess) {
+                    device.destroyDeferredOperationKHR(operation);
+                    continue;
+                }
+
+                if (result != vk::Result::eOperationDeferredKHR) {
+                    device.destroyDeferredOperationKHR(operation);
+                    throw std::runtime_error("Unable to create BLAS");
+                }
+
+                operations.push_back(operation);
+
+                const uint32_t threads = (_pool != nullptr) ? _pool->size() : 1;
+                const uint32_t concurrency = std::clamp(device.getDeferredOperationMaxConcurrencyKHR(operation), 1u, threads);
+                joins.insert(joins.end(), concurrency, operation);
+            }
+
+            // Join until this thread is done with the operation, idle threads retry until it completes
+            auto join = [device](vk::DeferredOperationKHR operation) {
+                while (true) {
+                    auto result = device.deferredOperationJoinKHR(operation);
+
+                    if (result == vk::Result::eSuccess || result == vk::Result::eThreadDoneKHR)
+                        return;
+
+                    if (result != vk::Result::eThreadIdleKHR)
+                        throw std::runtime_error("Joining a BLAS build failed");
+
+                    std::this_thread::yield();
+                }
+            };
+
+            if (_pool != nullptr) {
+                _pool->parallelFor(joins.size(), [&](size_t iter) {
+                    join(joins[iter]);
+                });
+            } else {
+                for (auto operation : joins)
+                    join(operation);
+            }
+
+            // eThreadDoneKHR only means no more work for that thread, the results say when it is over
+            for (auto operation : operations) {
+                vk::Result result;
+                while ((result = device.getDeferredOperationResultKHR(operation)) == vk::Result::eNotReady)
+                    std::this_thread::yield();
+
+                device.destroyDeferredOperationKHR(operation);
+
+                if (result != vk::Result::eSuccess)
+                    throw std::runtime_error("Unable to create BLAS");
+            }
+        }
+
+        for (auto& blas : _pending)
+            blas->releaseHostInputs();
+
+        _built = std::move(_pending);
+        _pending.clear();
+    }
+
+    uint64_t BLASBuilder_t::cacheKey() {
+        if (_cache == nullptr)
+            return 0;
+
+        uint64_t key = _pending.size();
+        for (auto& blas : _pending) {
+            auto hash = blas->inputHash();
+
+            // Without host copies there is nothing to key on
+            if (hash == 0)
+                return 0;
+
+            key ^= hash + 0x9E3779B97F4A7C15ull + (key << 6) + (key >> 2);
+        }
+
+        return key;
+    }
+
+    ReturnBuffer BLASBuilder_t::restore(CommandBuffer cmd, std::vector<std::span<const std::byte>> const & blobs) {
+        constexpr vk::DeviceSize alignment = AccelCache_t::blobAlignment;
+        auto align = [](vk::DeviceSize size) {
+            return (size + alignment - 1) / alignment * alignment;
+        };
+
+        vk::DeviceSize size = 0;
+        for (auto const & blob : blobs)
+            size += align(blob.size());
+
+        vk::BufferCreateInfo sourceCI{};
+        sourceCI.size = size + alignment;
+        sourceCI.usage = vk::BufferUsageFlagBits::eShaderDeviceAddress | vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR;
+
+        auto source = _allocator->create(sourceCI, VMA_MEMORY_USAGE_CPU_TO_GPU);
+
+        vk::BufferDeviceAddressInfo sourceAI{};
+        sourceAI.buffer = source.buffer;
+
+        const vk::DeviceAddress address = _device->raw().getBufferAddress(sourceAI);
+        const vk::DeviceAddress base = align(address);
+
+        void* data = nullptr;
+        _allocator->map(source.allocation, data);
+
+        vk::DeviceSize offset = 0;
+        for (size_t iter = 0; iter < blobs.size(); iter++) {
+            memcpy(static_cast<std::byte*>(data) + (base - address) + offset, blobs[iter].data(), blobs[iter].size());
+
+            vk::CopyMemoryToAccelerationStructureInfoKHR copyInfo{};
+            copyInfo.src.deviceAddress = base + offset;
+            copyInfo.dst = _pending[iter]->raw();
+            copyInfo.mode = vk::CopyAccelerationStructureModeKHR::eDeserialize;
+
+            cmd->raw().copyMemoryToAccelerationStructureKHR(copyInfo);
+            offset += align(blobs[iter].size());
+        }
+
+        _allocator->unmap(source.allocation);
+
+        return source;
+    }
+
+    void BLASBuilder_t::build() {
+        if (_pending.empty())
+            return;
+
+        _key = cacheKey();
+        _restored = false;
+
+        std::vector<std::span<const std::byte>> blobs;
+        if (_key != 0) {
+            blobs = _cache->load(_key, _pending.size());
+
+            // The header after the two UUIDs holds the serialized and the deserialized size
+            for (size_t iter = 0; iter < blobs.size(); iter++) {
+                uint64_t deserialized = 0;
+                if (blobs[iter].size() >= 2 * VK_UUID_SIZE + 2 * sizeof(uint64_t))
+                    memcpy(&deserialized, blobs[iter].data() + 2 * VK_UUID_SIZE + sizeof(uint64_t), sizeof(uint64_t));
+
+                if (deserialized == 0 || deserialized > _pending[iter]->size()) {
+                    blobs.clear();
+                    break;
+                }
+            }
+        }
+
+        _restored = !blobs.empty();
+
+        if (_onHost && !_restored) {
+            buildOnHost();
+            return;
+        }
+
+        const vk::DeviceSize alignment = std::max(1u, _device->_aStructProperties.minAccelerationStructureScratchOffsetAlignment);
+        auto align = [alignment](vk::DeviceSize size) {
+            return (size + alignment - 1) / alignment * alignment;
+        };
+
+        auto cmd = (_batch != nullptr) ? _batch->commandBuffer() : _commandPool->singleTimeBegin();
+
+        if (_compact) {
+            if (_queries)
+                _device->raw().destroyQueryPool(_queries);
+
+            vk::QueryPoolCreateInfo queryCI{};
+            queryCI.queryType = vk::QueryType::eAccelerationStructureCompactedSizeKHR;
+            queryCI.queryCount = _pending.size();
+
+            _queries = _device->raw().createQueryPool(queryCI);
+            cmd->raw().resetQueryPool(_queries, 0, _pending.size());
+        }
+
+        // Either the blobs to deserialize from or the scratch of the builds
+        ReturnBuffer scratch;
+
+        if (_restored) {
+            scratch = restore(cmd, blobs);
+            std::cout << "Restored " << _pending.size() << " BLASes from the cache" << std::endl;
+        } else {
+            vk::DeviceSize scratchSize;
+            auto runs = this->runs(alignment, scratchSize);
+
+            vk::BufferCreateInfo scratchCI{};
+            scratchCI.size = scratchSize + alignment;
+            scratchCI.usage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress;
+
+            scratch = _allocator->create(scratchCI, VMA_MEMORY_USAGE_GPU_ONLY);
+
+            vk::BufferDeviceAddressInfo scratchAI{};
+            scratchAI.buffer = scratch.buffer;
+
+            const vk::DeviceAddress base = align(_device->raw().getBufferAddress(scratchAI));
+
+            std::vector<vk::AccelerationStructureBuildGeometryInfoKHR> infos;
+            std::vector<const vk::AccelerationStructureBuildRangeInfoKHR*> ranges;
+
+            for (size_t run = 0; run + 1 < runs.size(); run++) {
+                if (run > 0) {
+                    // The next run overwrites the scratch of this one
+                    vk::MemoryBarrier memoryBarrier{};
+                    memoryBarrier.srcAccessMask = vk::AccessFlagBits::eAccelerationStructureWriteKHR;
+                    memoryBarrier.dstAccessMask = vk::AccessFlagBits::eAccelerationStructureReadKHR | vk::AccessFlagBits::eAccelerationStructureWriteKHR;
+
+                    cmd->raw().pipelineBarrier(vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+                            vk::DependencyFlags{0}, memoryBarrier, nullptr, nullptr);
+                }
+
+                infos.clear();
+                ranges.clear();
+
+                vk::DeviceSize offset = 0;
+                for (size_t iter = runs[run]; iter < runs[run + 1]; iter++) {
+                    infos.push_back(_pending[iter]->buildInfo(base + offset));
+                    ranges.push_back(&_pending[iter]->range());
+                    offset += align(_pending[iter]->scratchSize());
+                }
+
+                cmd->raw().buildAccelerationStructuresKHR(infos, ranges);
+            }
+        }
+
+        if (_compact) {
+            vk::MemoryBarrier memoryBarrier{};
+            memoryBarrier.srcAccessMask = vk::AccessFlagBits::eAccelerationStructureWriteKHR;
+            memoryBarrier.dstAccessMask = vk::AccessFlagBits::eAccelerationStructureReadKHR;
+
+            cmd->raw().pipelineBarrier(vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+                    vk::DependencyFlags{0}, memoryBarrier, nullptr, nullptr);
+
+            std::vector<vk::AccelerationStructureKHR> structures;
+            structures.reserve(_pending.size());
+            for (auto& blas : _pending)
+                structures.push_back(blas->raw());
+
+            cmd->raw().writeAccelerationStructuresPropertiesKHR(structures, vk::QueryType::eAccelerationStructureCompactedSizeKHR, _queries, 0);
+        }
+
+        if (_batch != nullptr) {
+            auto allocator = _allocator;
+            _batch->onComplete([allocator, scratch]() {
+                allocator->destroy(scratch.buffer, scratch.allocation);
+            });
+        } else {
+            _commandPool->singleTimeEnd(cmd, _queue);
+            _allocator->destroy(scratch.buffer, scratch.allocation);
+        }
+
+        for (auto& blas : _pending)
+            blas->releaseHostInputs();
+
+        _built = std::move(_pending);
+        _pending.clear();
+    }
+
+    void BLASBuilder_t::store() {
+        if (_built.empty() || _key == 0 || _restored)
+            return;
+
+        auto device = _device->raw();
+
+        vk::QueryPoolCreateInfo queryCI{};
+        queryCI.queryType = vk::QueryType::eAccelerationStructureSerializationSizeKHR;
+        queryCI.queryCount = _built.size();
+
+        auto queries = device.createQueryPool(queryCI);
+
+        std::vector<vk::AccelerationStructureKHR> structures;
+        structures.reserve(_built.size());
+        for (auto& blas : _built)
+            structures.push_back(blas->raw());
+
+        auto cmd = _commandPool->singleTimeBegin();
+        cmd->raw().resetQueryPool(queries, 0, _built.size());
+        cmd->raw().writeAccelerationStructuresPropertiesKHR(structures, vk::QueryType::eAccelerationStructureSerializationSizeKHR, queries, 0);
+        _commandPool->singleTimeEnd(cmd, _queue);
+
+        std::vector<vk::DeviceSize> sizes(_built.size());
+        auto result = device.getQueryPoolResults(queries, 0, sizes.size(), sizes.size() * sizeof(vk::DeviceSize),
+                sizes.data(), sizeof(vk::DeviceSize), vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait);
+
+        device.destroyQueryPool(queries);
+
+        if (result != vk::Result::eSuccess)
+            throw std::runtime_error("Couldn't read BLAS serialization sizes");
+
+        constexpr vk::DeviceSize alignment = AccelCache_t::blobAlignment;
+        auto align = [](vk::DeviceSize size) {
+            return (size + alignment - 1) / alignment * alignment;
+        };
+
+        vk::DeviceSize size = 0;
+        for (auto blobSize : sizes)
+            size += align(blobSize);
+
+        vk::BufferCreateInfo targetCI{};
+        targetCI.size = size + alignment;
+        targetCI.usage = vk::BufferUsageFlagBits::eShaderDeviceAddress | vk::BufferUsageFlagBits::eStorageBuffer;
+
+        auto target = _allocator->create(targetCI, VMA_MEMORY_USAGE_GPU_TO_CPU);
+
+        vk::BufferDeviceAddressInfo targetAI{};
+        targetAI.buffer = target.buffer;
+
+        const vk::DeviceAddress address = device.getBufferAddress(targetAI);
+        const vk::DeviceAddress base = align(address);
+
+        cmd = _commandPool->singleTimeBegin();
+
+        vk::DeviceSize offset = 0;
+        for (size_t iter = 0; iter < _built.size(); iter++) {
+            vk::CopyAccelerationStructureToMemoryInfoKHR copyInfo{};
+            copyInfo.src = _built[iter]->raw();
+            copyInfo.dst.deviceAddress = base + offset;
+            copyInfo.mode = vk::CopyAccelerationStructureModeKHR::eSerialize;
+
+            cmd->raw().copyAccelerationStructureToMemoryKHR(copyInfo);
+            offset += align(sizes[iter]);
+        }
+
+        _commandPool->singleTimeEnd(cmd, _queue);
+
+        void* data = nullptr;
+        _allocator->map(target.allocation, data);
+
+        std::vector<std::span<const std::byte>> blobs;
+        blobs.reserve(_built.size());
+
+        offset = base - address;
+        for (auto blobSize : sizes) {
+            blobs.emplace_back(static_cast<const std::byte*>(data) + offset, blobSize);
+            offset += align(blobSize);
+        }
+
+        _cache->store(_key, blobs);
+
+        _allocator->unmap(target.allocation);
+        _allocator->destroy(target.buffer, target.allocation);
+
+        std::cout << "Stored " << _built.size() << " BLASes in the cache" << std::endl;
+    }
+
+    void BLASBuilder_t::compact() {
+        if (_built.empty() || !_queries)
+            return;
+
+        std::vector<vk::DeviceSize> sizes(_built.size());
+        auto result = _device->raw().getQueryPoolResults(_queries, 0, sizes.size(), sizes.size() * sizeof(vk::DeviceSize),
+                sizes.data(), sizeof(vk::DeviceSize), vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait);
+
+        if (result != vk::Result::eSuccess)
+            throw std::runtime_error("Couldn't read compacted BLAS sizes");
+
+        vk::DeviceSize before = 0;
+        vk::DeviceSize after = 0;
+
+        auto cmd = _commandPool->singleTimeBegin();
+        for (size_t iter = 0; iter < _built.size(); iter++) {
+            before += _built[iter]->size();
+
+            // Nothing to gain, keep the original
+            if (sizes[iter] == 0 || sizes[iter] >= _built[iter]->size()) {
+                after += _built[iter]->size();
+                continue;
+            }
+
+            _built[iter]->compact(cmd, sizes[iter]);
+            after += sizes[iter];
+        }
+        _commandPool->singleTimeEnd(cmd, _queue);
+
+        for (auto& blas : _built)
+            blas->releaseRetired();
+
+        std::cout << "Compacted " << _built.size() << " BLASes from " << (before >> 10) << " KiB to "
+            << (after >> 10) << " KiB" << std::endl;
+
+        _device->raw().destroyQueryPool(_queries);
+        _queries = nullptr;
+    }
+
+    BLASBuilder_t::~BLASBuilder_t() {
+        if (_queries)
+            _device->raw().destroyQueryPool(_queries);
+    }
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <hdvw/device.hpp>
+#include <hdvw/allocator.hpp>
+#include <hdvw/commandpool.hpp>
+#include <hdvw/queue.hpp>
+#include <hdvw/uploadbatch.hpp>
+
+#include <engine/blas.hpp>
+#include <engine/threadpool.hpp>
+#include <engine/accelcache.hpp>
+
+#include <memory>
+#include <vector>
+#include <span>
+
+namespace hd {
+    struct BLASBuilderCreateInfo {
+        CommandPool commandPool;
+        Queue queue;
+        Device device;
+        Allocator allocator;
+        UploadBatch batch = nullptr; // Inputs must be made visible with batch->barrier() first
+        vk::DeviceSize scratchBudget = 256ull << 20; // Builds past it wait for the previous ones and reuse their scratch
+        bool compact = false; // Queries compacted sizes during build(), compact() uses them
+        // Builds on the host when the device supports it, BLASes then need their host inputs.
+        // Every BLAS is its own deferred operation, joined from pool. Compaction is skipped.
+        bool onHost = false;
+        ThreadPool pool = nullptr;
+        AccelCache cache = nullptr; // Deserializes the BLASes instead of building them when it has them, store() fills it
+    };
+
+    class BLASBuilder_t;
+    typedef std::shared_ptr<BLASBuilder_t> BLASBuilder;
+
+    // Collects BLASes and builds all of them in as few build calls as the scratch budget allows
+    class BLASBuilder_t {
+        private:
+            CommandPool _commandPool;
+            Queue _queue;
+            Device _device;
+            Allocator _allocator;
+            UploadBatch _batch;
+            vk::DeviceSize _scratchBudget;
+            bool _compact;
+            bool _onHost;
+            ThreadPool _pool;
+
+            std::vector<BLAS> _pending;
+            std::vector<BLAS> _built; // Last build(), for compact() and store()
+            vk::QueryPool _queries;
+
+            AccelCache _cache;
+            uint64_t _key = 0; // Of the last build(), 0 when it can't be cached
+            bool _restored = false;
+
+            uint64_t cacheKey();
+
+            // Records the deserialization of every pending BLAS, returns the buffer the copies read from
+            ReturnBuffer restore(CommandBuffer cmd, std::vector<std::span<const std::byte>> const & blobs);
+
+            // Split _pending into runs whose scratch fits the budget, returns the run boundaries
+            std::vector<size_t> runs(vk::DeviceSize alignment, vk::DeviceSize& scratchSize);
+
+            void buildOnHost();
+
+        public:
+            static BLASBuilder conjure(BLASBuilderCreateInfo const & ci) {
+                return std::make_shared<BLASBuilder_t>(ci);
+            }
+
+            BLASBuilder_t(BLASBuilderCreateInfo const & ci);
+
+            // The BLAS has an address right away, its contents only after build()
+            BLAS add(BLASCreateInfo ci);
+
+            void build();
+
+            // Only once everything build() recorded has completed, submits the copies and waits for them.
+            // Addresses of the built BLASes change, so instances have to be filled in afterwards.
+            void compact();
+
+            // Only once everything build() recorded has completed. Serializes the built BLASes into the
+            // cache unless they came from it, after compact() to store the compacted ones.
+            void store();
+
+            ~BLASBuilder_t();
+    };
+
+    inline BLASBuilder conjure(BLASBuilderCreateInfo const & ci) {
+        return BLASBuilder_t::conjure(ci);
+    }
+}
@@ -0,0 +1,239 @@
+#include <dynamicscene.hpp>
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <span>
+
+namespace hd {
+    DynamicScene_t::DynamicScene_t(DynamicSceneCreateInfo const & ci) {
+        _tlas = ci.tlas;
+        _lights = ci.lights;
+        _instanceData = ci.instances;
+        _lightData = ci.lightProps;
+        _lightBLAS = ci.lightBLAS;
+        _lightPositions = ci.lightPositions;
+        _pad = ci.pad;
+        _capacity = std::max<uint32_t>(ci.maxInstances, _instanceData.size());
+
+        _instanceMarks.resize(_capacity, false);
+        _lightMarks.resize(_lightData.size(), false);
+
+        const vk::DeviceSize instanceBytes = sizeof(vk::AccelerationStructureInstanceKHR) * _capacity;
+        const vk::DeviceSize lightBytes = sizeof(VRAM_Light) * _lightData.size();
+        const vk::DeviceSize vertexBytes = sizeof(glm::vec3) * _pad.size() * _lightData.size();
+
+        _lightVertices.resize(_pad.size() * _lightData.size());
+
+        _instances = hd::conjure({
+                .allocator = ci.allocator,
+                .size = instanceBytes,
+                .bufferUsage = vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eShaderDeviceAddress
+                    | vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR,
+                .memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY,
+                });
+
+        vk::BufferDeviceAddressInfo instancesAI{};
+        instancesAI.buffer = _instances->raw();
+
+        _instancesAddress = ci.device->raw().getBufferAddress(instancesAI);
+
+        _commandPool = hd::conjure({
+                .device = ci.device,
+                .family = PoolFamily::eGraphics,
+                .flags = vk::CommandPoolCreateFlagBits::eResetCommandBuffer,
+                });
+
+        _commandBuffers = _commandPool->allocate(ci.framesInFlight);
+
+        // Entries sit at the offset of their destination, instances first, then lights, then light vertices
+        _ring.reserve(ci.framesInFlight);
+        for (uint32_t iter = 0; iter < ci.framesInFlight; iter++) {
+            _ring.push_back(hd::conjure({
+                    .allocator = ci.allocator,
+                    .size = instanceBytes + lightBytes + vertexBytes,
+                    .bufferUsage = vk::BufferUsageFlagBits::eTransferSrc,
+                    .memoryUsage = VMA_MEMORY_USAGE_CPU_TO_GPU,
+                    }));
+        }
+    }
+
+    void DynamicScene_t::markInstance(uint32_t instance) {
+        if (_instanceMarks[instance])
+            return;
+
+        _instanceMarks[instance] = true;
+        _dirtyInstances.push_back(instance);
+    }
+
+    void DynamicScene_t::setLight(uint32_t light, Light const & props) {
+        glm::mat3x4 transform;
+        Model_t::generateLightPads(std::span<const Light>(&props, 1), std::span<VRAM_Light>(&_lightData.at(light), 1), std::span<glm::mat3x4>(&transform, 1));
+
+        Model_t::placeLightPads(std::span<const glm::mat3x4>(&transform, 1), _pad, std::span<glm::vec3>(_lightVertices).subspan(light * _pad.size(), _pad.size()));
+
+        if (!_lightMarks[light]) {
+            _lightMarks[light] = true;
+            _dirtyLights.push_back(light);
+        }
+    }
+
+    void DynamicScene_t::setTransform(uint32_t instance, glm::mat4 const & transform) {
+        // Vulkan wants the top 3 rows in row major order, glm is column major
+        const glm::mat4 rows = glm::transpose(transform);
+
+        memcpy(&_instanceData.at(instance).transform.matrix, glm::value_ptr(rows), 3 * 4 * sizeof(float));
+        markInstance(instance);
+    }
+
+    void DynamicScene_t::setInstance(uint32_t instance, vk::AccelerationStructureInstanceKHR const & record) {
+        _instanceData.at(instance) = record;
+        markInstance(instance);
+    }
+
+    uint32_t DynamicScene_t::addInstance(vk::AccelerationStructureInstanceKHR const & record) {
+        if (_instanceData.size() >= _capacity)
+            throw std::runtime_error("Dynamic scene is out of instances, raise maxInstances");
+
+        _instanceData.push_back(record);
+        _rebuild = true;
+
+        return _instanceData.size() - 1;
+    }
+
+    void DynamicScene_t::removeInstance(uint32_t instance) {
+        if (instance >= _instanceData.size())
+            throw std::runtime_error("Removing an instance that doesn't exist");
+
+        _instanceData.erase(_instanceData.begin() + instance);
+        _rebuild = true;
+    }
+
+    CommandBuffer DynamicScene_t::record(uint32_t frame) {
+        if (_dirtyInstances.empty() && _dirtyLights.empty() && !_rebuild)
+            return nullptr;
+
+        constexpr vk::DeviceSize instanceStride = sizeof(vk::AccelerationStructureInstanceKHR);
+        const vk::DeviceSize lightBase = instanceStride * _capacity;
+        const vk::DeviceSize vertexBase = lightBase + sizeof(VRAM_Light) * _lightData.size();
+        const vk::DeviceSize padStride = sizeof(glm::vec3) * _pad.size();
+
+        // Whole instance list whenever the layout changed or the TLAS still points elsewhere
+        if (_rebuild || _uploadAll) {
+            for (auto instance : _dirtyInstances)
+                _instanceMarks[instance] = false;
+
+            _dirtyInstances.resize(_instanceData.size());
+            for (uint32_t iter = 0; iter < _instanceData.size(); iter++)
+                _dirtyInstances[iter] = iter;
+        }
+
+        std::sort(_dirtyInstances.begin(), _dirtyInstances.end());
+        std::sort(_dirtyLights.begin(), _dirtyLights.end());
+
+        // Neighbouring entries share a copy region
+        auto regions = [](std::vector<uint32_t> const & dirty, vk::DeviceSize base, vk::DeviceSize stride) {
+            std::vector<vk::BufferCopy> copies;
+
+            for (size_t iter = 0; iter < dirty.size();) {
+                size_t end = iter + 1;
+                while (end < dirty.size() && dirty[end] == dirty[end - 1] + 1)
+                    end++;
+
+                copies.emplace_back(base + dirty[iter] * stride, dirty[iter] * stride, (end - iter) * stride);
+                iter = end;
+            }
+
+            return copies;
+        };
+
+        auto slot = _ring[frame];
+        auto data = reinterpret_cast<char*>(slot->map());
+
+        for (auto instance : _dirtyInstances)
+            memcpy(data + instance * instanceStride, &_instanceData[instance], instanceStride);
+
+        for (auto light : _dirtyLights)
+            memcpy(data + lightBase + light * sizeof(VRAM_Light), &_lightData[light], sizeof(VRAM_Light));
+
+        for (auto light : _dirtyLights)
+            memcpy(data + vertexBase + light * padStride, &_lightVertices[light * _pad.size()], padStride);
+
+        slot->unmap();
+
+        auto instanceCopies = regions(_dirtyInstances, 0, instanceStride);
+        auto lightCopies = regions(_dirtyLights, lightBase, sizeof(VRAM_Light));
+        auto vertexCopies = regions(_dirtyLights, vertexBase, padStride);
+
+        auto cmd = _commandBuffers[frame];
+        cmd->reset(false);
+        cmd->begin(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+
+        // Earlier frames may still trace the scene or refit the TLAS
+        vk::MemoryBarrier before{};
+        before.srcAccessMask = vk::AccessFlagBits::eAccelerationStructureWriteKHR;
+        before.dstAccessMask = vk::AccessFlagBits::eAccelerationStructureReadKHR | vk::AccessFlagBits::eAccelerationStructureWriteKHR;
+
+        cmd->raw().pipelineBarrier(
+                vk::PipelineStageFlagBits::eRayTracingShaderKHR | vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+                vk::PipelineStageFlagBits::eTransfer | vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+                vk::DependencyFlags{0}, before, nullptr, nullptr);
+
+        if (!instanceCopies.empty())
+            cmd->raw().copyBuffer(slot->raw(), _instances->raw(), instanceCopies);
+
+        if (!lightCopies.empty())
+            cmd->raw().copyBuffer(slot->raw(), _lights->raw(), lightCopies);
+
+        if (!vertexCopies.empty())
+            cmd->raw().copyBuffer(slot->raw(), _lightPositions->raw(), vertexCopies);
+
+        vk::MemoryBarrier copied{};
+        copied.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+        copied.dstAccessMask = vk::AccessFlagBits::eAccelerationStructureReadKHR | vk::AccessFlagBits::eShaderRead;
+
+        cmd->raw().pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR | vk::PipelineStageFlagBits::eRayTracingShaderKHR | vk::PipelineStageFlagBits::eComputeShader,
+                vk::DependencyFlags{0}, copied, nullptr, nullptr);
+
+        // The TLAS refit picks up the new bounds of the light BLAS
+        if (!_dirtyLights.empty()) {
+            _lightBLAS->update(cmd);
+
+            vk::MemoryBarrier refitted{};
+            refitted.srcAccessMask = vk::AccessFlagBits::eAccelerationStructureWriteKHR;
+            refitted.dstAccessMask = vk::AccessFlagBits::eAccelerationStructureReadKHR;
+
+            cmd->raw().pipelineBarrier(vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+                    vk::DependencyFlags{0}, refitted, nullptr, nullptr);
+        }
+
+        if (!_dirtyInstances.empty() || !_dirtyLights.empty() || _rebuild) {
+            _tlas->update(cmd, _instancesAddress, _instanceData.size(), _rebuild);
+
+            vk::MemoryBarrier built{};
+            built.srcAccessMask = vk::AccessFlagBits::eAccelerationStructureWriteKHR;
+            built.dstAccessMask = vk::AccessFlagBits::eAccelerationStructureReadKHR;
+
+            cmd->raw().pipelineBarrier(vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, vk::PipelineStageFlagBits::eRayTracingShaderKHR,
+                    vk::DependencyFlags{0}, built, nullptr, nullptr);
+
+            _uploadAll = false;
+        }
+
+        cmd->end();
+
+        for (auto instance : _dirtyInstances)
+            _instanceMarks[instance] = false;
+
+        for (auto light : _dirtyLights)
+            _lightMarks[light] = false;
+
+        _dirtyInstances.clear();
+        _dirtyLights.clear();
+        _rebuild = false;
+
+        return cmd;
+    }
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+#include <glm/glm.hpp>
+
+#include <hdvw/device.hpp>
+#include <hdvw/allocator.hpp>
+#include <hdvw/commandpool.hpp>
+#include <hdvw/commandbuffer.hpp>
+#include <hdvw/buffer.hpp>
+#include <hdvw/databuffer.hpp>
+
+#include <engine/blas.hpp>
+#include <engine/tlas.hpp>
+#include <engine/model.hpp>
+
+#include <memory>
+#include <vector>
+
+namespace hd {
+    struct DynamicSceneCreateInfo {
+        Device device;
+        Allocator allocator;
+        TLAS tlas; // Created with allowUpdate
+        DataBuffer<VRAM_Light> lights;
+        std::vector<vk::AccelerationStructureInstanceKHR> instances; // What the TLAS was built from
+        std::vector<VRAM_Light> lightProps; // What lights holds
+        BLAS lightBLAS; // Every light pad merged, created with allowUpdate
+        DataBuffer<glm::vec3> lightPositions; // Its vertices, pad.size() per light in light order
+        std::vector<glm::vec3> pad; // Unit pad the light vertices are placed from
+        uint32_t maxInstances = 0; // The maxInstances of the TLAS, instances.size() when 0
+        uint32_t framesInFlight;
+    };
+
+    class DynamicScene_t;
+    typedef std::shared_ptr<DynamicScene_t> DynamicScene;
+
+    // Moves lights and instances after startup. Changes are staged through a host visible slot per
+    // frame in flight and applied by record(), which refits the light BLAS and the TLAS, or rebuilds
+    // the TLAS when the instance count changed.
+    class DynamicScene_t {
+        private:
+            TLAS _tlas;
+            DataBuffer<VRAM_Light> _lights;
+            BLAS _lightBLAS;
+            DataBuffer<glm::vec3> _lightPositions;
+
+            std::vector<vk::AccelerationStructureInstanceKHR> _instanceData;
+            std::vector<VRAM_Light> _lightData;
+            std::vector<glm::vec3> _pad;
+            std::vector<glm::vec3> _lightVertices;
+            uint32_t _capacity;
+
+            std::vector<uint32_t> _dirtyInstances;
+            std::vector<uint32_t> _dirtyLights;
+            std::vector<bool> _instanceMarks;
+            std::vector<bool> _lightMarks;
+            bool _rebuild = false;
+            bool _uploadAll = true; // The TLAS was built from another buffer, the first refit copies every instance
+
+            Buffer _instances; // What the TLAS is refitted from
+            vk::DeviceAddress _instancesAddress;
+
+            CommandPool _commandPool;
+            std::vector<CommandBuffer> _commandBuffers;
+            std::vector<Buffer> _ring;
+
+            void markInstance(uint32_t instance);
+
+        public:
+            static DynamicScene conjure(DynamicSceneCreateInfo const & ci) {
+                return std::make_shared<DynamicScene_t>(ci);
+            }
+
+            DynamicScene_t(DynamicSceneCreateInfo const & ci);
+
+            inline auto instanceCount() {
+                return static_cast<uint32_t>(_instanceData.size());
+            }
+
+            inline auto lightCount() {
+                return static_cast<uint32_t>(_lightData.size());
+            }
+
+            inline auto const & instance(uint32_t instance) {
+                return _instanceData.at(instance);
+            }
+
+            // Moves the light and its pad inside the light BLAS
+            void setLight(uint32_t light, Light const & props);
+
+            void setTransform(uint32_t instance, glm::mat4 const & transform);
+
+            void setInstance(uint32_t instance, vk::AccelerationStructureInstanceKHR const & record);
+
+            // Adding and removing instances rebuild the TLAS on the next record()
+            uint32_t addInstance(vk::AccelerationStructureInstanceKHR const & record);
+
+            // Instances after it move down by one
+            void removeInstance(uint32_t instance);
+
+            // Call once the fence of frame has been waited on. Returns nullptr when nothing changed,
+            // otherwise a command buffer that has to run before anything tracing the scene.
+            CommandBuffer record(uint32_t frame);
+    };
+
+    inline DynamicScene conjure(DynamicSceneCreateInfo const & ci) {
+        return DynamicScene_t::conjure(ci);
+    }
+}
@@ -0,0 +1,84 @@
+#include <mappedfile.hpp>
+
+#include <stdexcept>
+#include <string>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace hd {
+#ifdef _WIN32
+    MappedFile_t::MappedFile_t(MappedFileCreateInfo const & ci) {
+        std::string filename(ci.filename);
+
+        _file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (_file == INVALID_HANDLE_VALUE)
+            throw std::runtime_error("Couldn't open " + filename);
+
+        LARGE_INTEGER size;
+        GetFileSizeEx(_file, &size);
+        _size = size.QuadPart;
+
+        if (_size == 0)
+            return;
+
+        _mapping = CreateFileMappingA(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (_mapping == nullptr)
+            throw std::runtime_error("Couldn't map " + filename);
+
+        _data = static_cast<const uint8_t*>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+        if (_data == nullptr)
+            throw std::runtime_error("Couldn't map " + filename);
+    }
+
+    MappedFile_t::~MappedFile_t() {
+        if (_data != nullptr)
+            UnmapViewOfFile(_data);
+        if (_mapping != nullptr)
+            CloseHandle(_mapping);
+        if (_file != nullptr && _file != INVALID_HANDLE_VALUE)
+            CloseHandle(_file);
+    }
+#else
+    MappedFile_t::MappedFile_t(MappedFileCreateInfo const & ci) {
+        std::string filename(ci.filename);
+
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("Couldn't open " + filename);
+
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            close(fd);
+            throw std::runtime_error("Couldn't stat " + filename);
+        }
+        _size = info.st_size;
+
+        if (_size == 0) {
+            close(fd);
+            return;
+        }
+
+        void* data = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+
+        if (data == MAP_FAILED)
+            throw std::runtime_error("Couldn't map " + filename);
+
+        // The whole file is consumed front to back right away
+        madvise(data, _size, MADV_WILLNEED);
+        _data = static_cast<const uint8_t*>(data);
+    }
+
+    MappedFile_t::~MappedFile_t() {
+        if (_data != nullptr)
+            munmap(const_cast<uint8_t*>(_data), _size);
+    }
+#endif
+}
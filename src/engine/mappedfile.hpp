@@ -0,0 +1,51 @@
+#pragma once
+
+#include <string_view>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+namespace hd {
+    struct MappedFileCreateInfo {
+        std::string_view filename;
+    };
+
+    class MappedFile_t;
+    typedef std::shared_ptr<MappedFile_t> MappedFile;
+
+    class MappedFile_t {
+        private:
+            const uint8_t* _data = nullptr;
+            size_t _size = 0;
+#ifdef _WIN32
+            void* _file = nullptr;
+            void* _mapping = nullptr;
+#endif
+
+        public:
+            static MappedFile conjure(MappedFileCreateInfo const & ci) {
+                return std::make_shared<MappedFile_t>(ci);
+            }
+
+            MappedFile_t(MappedFileCreateInfo const & ci);
+
+            inline auto data() {
+                return _data;
+            }
+
+            inline auto size() {
+                return _size;
+            }
+
+            template<class T>
+            inline const T* at(size_t offset) {
+                return reinterpret_cast<const T*>(_data + offset);
+            }
+
+            ~MappedFile_t();
+    };
+
+    inline MappedFile conjure(MappedFileCreateInfo const & ci) {
+        return MappedFile_t::conjure(ci);
+    }
+}
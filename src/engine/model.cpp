@@ -1,8 +1,21 @@
 #include <model.hpp>
 
+#include <engine/mappedfile.hpp>
+
 #include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <cmath>
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/type_ptr.hpp>
 
-#include <rapidjson/document.h>
+#include <rapidjson/reader.h>
+#include <rapidjson/memorystream.h>
+#include <rapidjson/error/en.h>
 
 namespace hd {
     Mesh Model_t::processMesh(aiMesh *mesh, const aiScene *scene) {
@@ -101,43 +114,30 @@ namespace hd {
         if (material->Get(AI_MATKEY_SHADING_MODEL, ret.material.shadingModel) != AI_SUCCESS)
             ret.material.shadingModel = 0;
 
+        ret.material.uvDensity = uvDensity(ret.vertices, ret.indices);
+
         ret.material.diffuseMapCount = material->GetTextureCount(aiTextureType_DIFFUSE);
-        ret.diffuse.reserve(ret.material.diffuseMapCount);
+        ret.diffusePaths.reserve(ret.material.diffuseMapCount);
         for (uint32_t i = 0; i < ret.material.diffuseMapCount; i++) {
             aiString filename;
             material->GetTexture(aiTextureType_DIFFUSE, i, &filename);
 
-            ret.diffuse.push_back(textureConjure(filename.C_Str()));
+            ret.diffusePaths.push_back(filename.C_Str());
         }
 
         return ret;
     }
 
-    void Model_t::processNode(aiNode *node, const aiScene *scene, bool multiply) {
-        meshes.reserve(meshes.size() + 2 * node->mNumMeshes);
-        for(uint32_t i = 0; i < node->mNumMeshes; i++)
-        {
-            aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-            meshes.push_back(processMesh(mesh, scene));
-
-            if (!multiply)
-                continue;
+    void Model_t::processNode(aiNode *node, glm::mat4 const & parent) {
+        // Assimp matrices are row major
+        const glm::mat4 transform = parent * glm::transpose(glm::make_mat4(&node->mTransformation.a1));
 
-            auto res = meshes.back();
-            for (uint32_t i = 1; i < 100; i++) {
-                auto mesh_dup = res;
-
-                uint32_t x = i / 10, y = i % 10;
-                for (uint32_t idx = 0; idx < mesh->mNumVertices; idx++) {
-                    mesh_dup.vertices[idx].pos += glm::vec3(18.1f * x, 0.0f, -18.1f * y);
-                }
-                meshes.push_back(mesh_dup);
-            }
-        }
+        for(uint32_t i = 0; i < node->mNumMeshes; i++)
+            instances.push_back({ .transform = transform, .mesh = node->mMeshes[i] });
 
         for(unsigned int i = 0; i < node->mNumChildren; i++)
         {
-            processNode(node->mChildren[i], scene, multiply);
+            processNode(node->mChildren[i], transform);
         }
     }
 
@@ -152,102 +152,360 @@ namespace hd {
             return;
         }
 
-        textureConjure = ci.textureConjure;
-        processNode(scene->mRootNode, scene, ci.multiply);
+        processNode(scene->mRootNode, glm::mat4(1.0f));
+
+        // Meshes keep the scene order so node mesh indices can be used as is
+        meshes.resize(scene->mNumMeshes);
+
+        auto pool = (ci.pool != nullptr) ? ci.pool : ThreadPool_t::conjure({});
+
+        pool->parallelFor(meshes.size(), [&](size_t iter) {
+            meshes[iter] = processMesh(scene->mMeshes[iter], scene);
+        });
+
+        if (ci.weld) {
+            size_t before = 0, after = 0;
+            for (auto const & mesh : meshes)
+                before += mesh.vertices.size();
+
+            pool->parallelFor(meshes.size(), [&](size_t iter) {
+                weld(meshes[iter].vertices, meshes[iter].indices);
+            });
+
+            for (auto const & mesh : meshes)
+                after += mesh.vertices.size();
+
+            std::cout << "Welded " << before << " vertices into " << after << std::endl;
+        }
+
+        for (auto& mesh : meshes)
+            requestTextures(mesh, ci.textures);
+
+        if (!ci.multiply)
+            return;
+
+        // The 10x10 grid only adds instances, geometry is shared
+        const size_t nodeInstances = instances.size();
+        instances.reserve(nodeInstances * 100);
+
+        for (uint32_t i = 1; i < 100; i++) {
+            uint32_t x = i / 10, y = i % 10;
+            const auto offset = glm::translate(glm::mat4(1.0f), glm::vec3(18.1f * x, 0.0f, -18.1f * y));
+
+            for (size_t iter = 0; iter < nodeInstances; iter++)
+                instances.push_back({ .transform = offset * instances[iter].transform, .mesh = instances[iter].mesh });
+        }
+    }
+
+    float Model_t::uvDensity(std::vector<Vertex> const & vertices, std::vector<uint32_t> const & indices) {
+        double worldArea = 0.0, uvArea = 0.0;
+
+        for (size_t iter = 0; iter + 2 < indices.size(); iter += 3) {
+            auto const & v0 = vertices[indices[iter + 0]];
+            auto const & v1 = vertices[indices[iter + 1]];
+            auto const & v2 = vertices[indices[iter + 2]];
+
+            worldArea += glm::length(glm::cross(v1.pos - v0.pos, v2.pos - v0.pos));
+
+            const glm::vec2 e1 = v1.texCoord - v0.texCoord, e2 = v2.texCoord - v0.texCoord;
+            uvArea += std::abs(e1.x * e2.y - e1.y * e2.x);
+        }
+
+        if (worldArea <= 0.0 || uvArea <= 0.0)
+            return 0.0f;
+
+        return static_cast<float>(std::sqrt(uvArea / worldArea));
     }
 
-    std::vector<Light> Model_t::parseLights(std::string_view filename, bool multiply) {
-        std::vector<Light> lights;
+    void Model_t::requestTextures(Mesh& mesh, TextureCache textures) {
+        mesh.diffuse.clear();
+        mesh.material.diffuseIndex = 0;
+        if (textures == nullptr)
+            return;
 
-        std::ifstream file(filename.data(), std::ios_base::in);
-        assert(!file.fail());
+        mesh.diffuse.reserve(mesh.diffusePaths.size());
+        for (auto const & path : mesh.diffusePaths)
+            mesh.diffuse.push_back(textures->request(path));
 
-        std::stringstream fileStr;
-        fileStr << file.rdbuf();
-        file.close();
+        mesh.material.diffuseIndex = mesh.diffuse.empty() ? 0 : mesh.diffuse[0];
+    }
 
-        rapidjson::Document sceneJSON;
-        sceneJSON.Parse(fileStr.str().c_str());
-        fileStr.clear();
+    Model_t::Model_t(std::vector<Mesh>&& meshes, std::vector<Instance>&& instances) : meshes(std::move(meshes)), instances(std::move(instances)) {}
 
-        assert(sceneJSON.IsObject());
+    // Streams the "Lights" array of a scene description, every other top level key is skipped
+    struct LightsHandler : rapidjson::BaseReaderHandler<rapidjson::UTF8<>, LightsHandler> {
+        enum class State { eRoot, eTop, eLightsKey, eLights, eLight, eValue, eArray, eSkip, eDone };
+        enum Field : uint32_t { ePos, eColor, eIntensity, eDims, eRotate, eFieldCount };
 
-        const auto& lightsValue = sceneJSON["Lights"];
-        assert(lightsValue.IsArray());
+        static constexpr const char* names[eFieldCount] = { "pos", "color", "intensity", "dims", "rotate" };
+        static constexpr uint32_t sizes[eFieldCount] = { 3, 3, 1, 2, 3 };
 
-        lights.reserve(lightsValue.Size());
-        for (const auto& lightInfo : lightsValue.GetArray()) {
-            assert(lightInfo.IsObject());
+        std::vector<Light>& lights;
+        std::string error;
 
-            const auto& posInfo = lightInfo["pos"];
-            assert(posInfo.IsArray());
-            assert(posInfo.Size() == 3);
+        State state = State::eRoot;
+        State skipReturn = State::eTop;
+        uint32_t skipDepth = 0;
+        bool found = false;
 
-            glm::vec3 pos(0.0f);
-            for (rapidjson::SizeType i = 0; i < posInfo.Size(); i++) {
-                assert(posInfo[i].IsFloat());
-                pos[i] = posInfo[i].GetFloat();
-            }
+        Field field = ePos;
+        uint32_t component = 0;
+        uint32_t seen = 0;
+        float values[eFieldCount][3] = {};
+
+        LightsHandler(std::vector<Light>& lights) : lights(lights) {}
 
-            const auto& colorInfo = lightInfo["color"];
-            assert(colorInfo.IsArray());
-            assert(colorInfo.Size() == 3);
+        bool fail(std::string message) {
+            error = std::move(message);
+            return false;
+        }
 
-            glm::vec3 color(0.0f);
-            for (rapidjson::SizeType i = 0; i < colorInfo.Size(); i++) {
-                assert(colorInfo[i].IsFloat());
-                color[i] = colorInfo[i].GetFloat();
+        bool skip(State from) {
+            skipReturn = from;
+            skipDepth = 0;
+            state = State::eSkip;
+            return true;
+        }
+
+        bool skipped() {
+            if (skipDepth == 0)
+                state = skipReturn;
+            return true;
+        }
+
+        bool Number(double value) {
+            switch (state) {
+                case State::eSkip:
+                    return skipped();
+                case State::eValue:
+                    if (sizes[field] != 1)
+                        return fail(std::string("\"") + names[field] + "\" must be an array of " + std::to_string(sizes[field]) + " numbers");
+                    values[field][0] = static_cast<float>(value);
+                    seen |= 1u << field;
+                    state = State::eLight;
+                    return true;
+                case State::eArray:
+                    if (component >= sizes[field])
+                        return fail(std::string("\"") + names[field] + "\" has more than " + std::to_string(sizes[field]) + " components");
+                    values[field][component++] = static_cast<float>(value);
+                    return true;
+                default:
+                    return fail("unexpected number");
             }
+        }
+
+        bool Int(int value) { return Number(value); }
+        bool Uint(unsigned value) { return Number(value); }
+        bool Int64(int64_t value) { return Number(static_cast<double>(value)); }
+        bool Uint64(uint64_t value) { return Number(static_cast<double>(value)); }
+        bool Double(double value) { return Number(value); }
 
-            const auto& intensityInfo = lightInfo["intensity"];
-            assert(intensityInfo.IsFloat());
+        // Null, Bool and String
+        bool Default() {
+            if (state == State::eSkip)
+                return skipped();
 
-            float intensity = intensityInfo.GetFloat();
+            if (state == State::eValue || state == State::eArray)
+                return fail(std::string("\"") + names[field] + "\" must be numeric");
 
-            const auto& dimsInfo = lightInfo["dims"];
-            assert(dimsInfo.IsArray());
-            assert(dimsInfo.Size() == 2);
+            return fail("unexpected value");
+        }
 
-            glm::vec2 dims(0.0f);
-            for (rapidjson::SizeType i = 0; i < dimsInfo.Size(); i++) {
-                assert(dimsInfo[i].IsFloat());
-                dims[i] = dimsInfo[i].GetFloat();
+        bool StartObject() {
+            switch (state) {
+                case State::eRoot:
+                    state = State::eTop;
+                    return true;
+                case State::eLights:
+                    seen = 0;
+                    state = State::eLight;
+                    return true;
+                case State::eSkip:
+                    skipDepth++;
+                    return true;
+                default:
+                    return fail("unexpected object");
             }
+        }
 
-            const auto& rotateInfo = lightInfo["rotate"];
-            assert(rotateInfo.IsArray());
-            assert(rotateInfo.Size() == 3);
+        bool Key(const char* str, rapidjson::SizeType length, bool) {
+            const std::string_view key(str, length);
+
+            switch (state) {
+                case State::eTop:
+                    if (key != "Lights")
+                        return skip(State::eTop);
+                    found = true;
+                    state = State::eLightsKey;
+                    return true;
+                case State::eLight:
+                    for (uint32_t iter = 0; iter < eFieldCount; iter++) {
+                        if (key == names[iter]) {
+                            field = static_cast<Field>(iter);
+                            state = State::eValue;
+                            return true;
+                        }
+                    }
+                    return skip(State::eLight);
+                case State::eSkip:
+                    return true;
+                default:
+                    return fail("unexpected key \"" + std::string(key) + "\"");
+            }
+        }
 
-            glm::vec3 rotate(0.0f);
-            for (rapidjson::SizeType i = 0; i < rotateInfo.Size(); i++) {
-                assert(rotateInfo[i].IsFloat());
-                rotate[i] = glm::radians(rotateInfo[i].GetFloat());
+        bool EndObject(rapidjson::SizeType) {
+            switch (state) {
+                case State::eLight:
+                    for (uint32_t iter = 0; iter < eFieldCount; iter++) {
+                        if ((seen & (1u << iter)) == 0)
+                            return fail("light " + std::to_string(lights.size()) + " has no \"" + names[iter] + "\"");
+                    }
+
+                    lights.push_back({
+                            .pos = glm::vec3(values[ePos][0], values[ePos][1], values[ePos][2]),
+                            .color = glm::vec3(values[eColor][0], values[eColor][1], values[eColor][2]),
+                            .intensity = values[eIntensity][0],
+                            .dims = glm::vec2(values[eDims][0], values[eDims][1]),
+                            .rotate = glm::radians(glm::vec3(values[eRotate][0], values[eRotate][1], values[eRotate][2])),
+                            });
+                    state = State::eLights;
+                    return true;
+                case State::eTop:
+                    state = State::eDone;
+                    return true;
+                case State::eSkip:
+                    skipDepth--;
+                    return skipped();
+                default:
+                    return fail("unexpected end of object");
             }
+        }
 
-            lights.push_back({
-                    .pos = pos,
-                    .color = color,
-                    .intensity = intensity,
-                    .dims = dims,
-                    .rotate = rotate,
-                    });
+        bool StartArray() {
+            switch (state) {
+                case State::eLightsKey:
+                    state = State::eLights;
+                    return true;
+                case State::eValue:
+                    if (sizes[field] == 1)
+                        return fail(std::string("\"") + names[field] + "\" must be a number");
+                    component = 0;
+                    state = State::eArray;
+                    return true;
+                case State::eSkip:
+                    skipDepth++;
+                    return true;
+                default:
+                    return fail("unexpected array");
+            }
+        }
 
-            if (!multiply)
-                continue;
+        bool EndArray(rapidjson::SizeType) {
+            switch (state) {
+                case State::eArray:
+                    if (component != sizes[field])
+                        return fail(std::string("\"") + names[field] + "\" needs " + std::to_string(sizes[field]) + " components");
+                    seen |= 1u << field;
+                    state = State::eLight;
+                    return true;
+                case State::eLights:
+                    state = State::eTop;
+                    return true;
+                case State::eSkip:
+                    skipDepth--;
+                    return skipped();
+                default:
+                    return fail("unexpected end of array");
+            }
+        }
+    };
+
+    // Same 10x10 grid as the multiplied geometry, every light is followed by its copies
+    static std::vector<Light> multiplyLights(std::vector<Light> const & lights) {
+        std::vector<Light> ret;
+        ret.reserve(lights.size() * 100);
+
+        for (auto const & light : lights) {
+            ret.push_back(light);
 
             for (uint32_t i = 1; i < 100; i++) {
                 uint32_t x = i / 10, y = i % 10;
-                lights.push_back({
-                        .pos = pos + glm::vec3(18.1f * x, 0.0f, -18.1f * y),
-                        .color = color,
-                        .intensity = intensity,
-                        .dims = dims,
-                        .rotate = rotate,
-                        });
+                ret.push_back(light);
+                ret.back().pos += glm::vec3(18.1f * x, 0.0f, -18.1f * y);
             }
         }
 
-        return lights;
+        return ret;
+    }
+
+    static constexpr char lightFileMagic[8] = { 'H', 'D', 'L', 'I', 'G', 'H', 'T', '\0' };
+
+    std::vector<Light> Model_t::parseLights(std::string_view filename, bool multiply) {
+        std::vector<Light> lights;
+
+        if (std::filesystem::path(filename).extension() == ".lights") {
+            lights = loadLights(filename);
+            return multiply ? multiplyLights(lights) : lights;
+        }
+
+        auto file = hd::conjure(MappedFileCreateInfo{ .filename = filename });
+
+        // No light takes less than this many bytes of JSON
+        lights.reserve(file->size() / 64);
+
+        LightsHandler handler(lights);
+        rapidjson::MemoryStream stream(file->at<char>(0), file->size());
+        rapidjson::Reader reader;
+
+        if (!reader.Parse(stream, handler) || !handler.found) {
+            const size_t offset = reader.HasParseError() ? reader.GetErrorOffset() : file->size();
+            const auto begin = file->at<char>(0);
+            const auto line = std::count(begin, begin + std::min(offset, file->size()), '\n') + 1;
+
+            std::string message = !handler.error.empty() ? handler.error
+                : reader.HasParseError() ? rapidjson::GetParseError_En(reader.GetParseErrorCode())
+                : "no \"Lights\" array";
+
+            throw std::runtime_error(std::string(filename) + ":" + std::to_string(line) + ": " + message);
+        }
+
+        return multiply ? multiplyLights(lights) : lights;
+    }
+
+    std::vector<Light> Model_t::loadLights(std::string_view filename) {
+        auto file = hd::conjure(MappedFileCreateInfo{ .filename = filename });
+
+        if (file->size() < sizeof(LightFileHeader))
+            throw std::runtime_error(std::string(filename) + ": truncated light file");
+
+        auto header = file->at<LightFileHeader>(0);
+        if (memcmp(header->magic, lightFileMagic, sizeof(lightFileMagic)) != 0)
+            throw std::runtime_error(std::string(filename) + ": not a light file");
+
+        if (header->version != LightFileHeader::currentVersion || header->lightSize != sizeof(Light))
+            throw std::runtime_error(std::string(filename) + ": unsupported light file version");
+
+        if (header->lightCount > (file->size() - sizeof(LightFileHeader)) / sizeof(Light))
+            throw std::runtime_error(std::string(filename) + ": truncated light file");
+
+        auto lights = file->at<Light>(sizeof(LightFileHeader));
+        return std::vector<Light>(lights, lights + header->lightCount);
+    }
+
+    void Model_t::storeLights(std::string_view filename, std::vector<Light> const & lights) {
+        LightFileHeader header{};
+        memcpy(header.magic, lightFileMagic, sizeof(lightFileMagic));
+        header.version = LightFileHeader::currentVersion;
+        header.lightSize = sizeof(Light);
+        header.lightCount = lights.size();
+
+        std::ofstream file(std::string(filename), std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!file.is_open())
+            throw std::runtime_error("Couldn't write " + std::string(filename));
+
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(lights.data()), sizeof(Light) * lights.size());
     }
 
     LightPadInfo Model_t::generateLightPad(Light light) {
@@ -310,6 +568,454 @@ namespace hd {
         ret.props.ab = generatedVertices[1] - generatedVertices[0];
         ret.props.ac = generatedVertices[2] - generatedVertices[0];
 
+        ret.transform = translateAbs * rotate * glm::scale(glm::mat4(1.0f), glm::vec3(light.dims[0], 1.0f, light.dims[1]));
+
         return ret;
     }
+
+    void Model_t::generateLightPads(std::span<const Light> lights, std::span<VRAM_Light> props, std::span<glm::mat3x4> transforms, ThreadPool pool) {
+        if (props.size() < lights.size() || transforms.size() < lights.size())
+            throw std::runtime_error("Light pad outputs are smaller than the light list");
+
+        // Closed form of generateLightPad: the pad spans -R[0] * dims.x and -R[2] * dims.y from its first corner
+        auto generate = [&](size_t begin, size_t end) {
+            for (size_t iter = begin; iter < end; iter++) {
+                auto const & light = lights[iter];
+                const glm::mat3 R = glm::mat3_cast(glm::normalize(glm::quat(light.rotate)));
+
+                const glm::vec3 x = R[0] * light.dims[0];
+                const glm::vec3 z = R[2] * light.dims[1];
+
+                auto& prop = props[iter];
+                prop.color = light.color;
+                prop.intensity = light.intensity;
+                prop.normal = (light.dims[0] * light.dims[1] >= 0.0f) ? -R[1] : R[1];
+                prop.a = light.pos + 0.5f * (x + z);
+                prop.ab = -x;
+                prop.ac = -z;
+
+                auto& transform = transforms[iter];
+                transform[0] = glm::vec4(x[0], R[1][0], z[0], light.pos[0]);
+                transform[1] = glm::vec4(x[1], R[1][1], z[1], light.pos[1]);
+                transform[2] = glm::vec4(x[2], R[1][2], z[2], light.pos[2]);
+            }
+        };
+
+        constexpr size_t batch = 4096;
+        const size_t batches = (lights.size() + batch - 1) / batch;
+
+        if (pool == nullptr || batches < 2) {
+            generate(0, lights.size());
+            return;
+        }
+
+        pool->parallelFor(batches, [&](size_t iter) {
+            generate(iter * batch, std::min(lights.size(), (iter + 1) * batch));
+        });
+    }
+
+    void Model_t::placeLightPads(std::span<const glm::mat3x4> transforms, std::span<const glm::vec3> pad, std::span<glm::vec3> positions, ThreadPool pool) {
+        if (positions.size() < transforms.size() * pad.size())
+            throw std::runtime_error("Light pad positions are smaller than the placed pads");
+
+        // Rows of the transform are the columns of the glm matrix
+        auto place = [&](size_t begin, size_t end) {
+            for (size_t iter = begin; iter < end; iter++) {
+                auto const & transform = transforms[iter];
+
+                for (size_t vert = 0; vert < pad.size(); vert++) {
+                    const glm::vec4 point(pad[vert], 1.0f);
+                    positions[iter * pad.size() + vert] = glm::vec3(glm::dot(transform[0], point), glm::dot(transform[1], point), glm::dot(transform[2], point));
+                }
+            }
+        };
+
+        constexpr size_t batch = 4096;
+        const size_t batches = (transforms.size() + batch - 1) / batch;
+
+        if (pool == nullptr || batches < 2) {
+            place(0, transforms.size());
+            return;
+        }
+
+        pool->parallelFor(batches, [&](size_t iter) {
+            place(iter * batch, std::min(transforms.size(), (iter + 1) * batch));
+        });
+    }
+
+    std::vector<VRAM_AliasEntry> Model_t::buildAliasTable(std::span<const VRAM_Light> lights) {
+        const size_t count = lights.size();
+        std::vector<VRAM_AliasEntry> table(count);
+
+        std::vector<double> power(count);
+        double total = 0.0;
+        for (size_t iter = 0; iter < count; iter++) {
+            auto const & light = lights[iter];
+            power[iter] = std::max(0.0, double(light.intensity) * glm::length(glm::cross(light.ab, light.ac)));
+            total += power[iter];
+        }
+
+        if (!(total > 0.0) || !std::isfinite(total)) {
+            std::fill(power.begin(), power.end(), 1.0);
+            total = count;
+        }
+
+        // Scaled so the average entry is 1, entries below it borrow from the ones above
+        std::vector<double> scaled(count);
+        std::vector<uint32_t> small, large;
+        for (size_t iter = 0; iter < count; iter++) {
+            scaled[iter] = power[iter] * count / total;
+            table[iter].pdf = scaled[iter];
+            table[iter].alias = iter;
+
+            (scaled[iter] < 1.0 ? small : large).push_back(iter);
+        }
+
+        while (!small.empty() && !large.empty()) {
+            const uint32_t less = small.back();
+            const uint32_t more = large.back();
+            small.pop_back();
+
+            table[less].prob = scaled[less];
+            table[less].alias = more;
+
+            scaled[more] -= 1.0 - scaled[less];
+            if (scaled[more] < 1.0) {
+                large.pop_back();
+                small.push_back(more);
+            }
+        }
+
+        // Whatever is left is 1 up to rounding
+        for (auto iter : small)
+            table[iter].prob = 1.0f;
+        for (auto iter : large)
+            table[iter].prob = 1.0f;
+
+        return table;
+    }
+
+    std::vector<VRAM_LightNode> Model_t::buildLightTree(std::span<const VRAM_Light> lights) {
+        if (lights.empty())
+            return {};
+
+        constexpr float pi = 3.14159265f;
+
+        auto rotate = [](glm::vec3 v, glm::vec3 k, float angle) {
+            return v * std::cos(angle) + glm::cross(k, v) * std::sin(angle) + k * glm::dot(k, v) * (1.0f - std::cos(angle));
+        };
+
+        // Smallest cone around both, as angles so the union can be grown around the wider one
+        auto cone = [&](VRAM_LightNode const & a, VRAM_LightNode const & b) {
+            float thetaA = std::acos(std::clamp(a.cosTheta, -1.0f, 1.0f));
+            float thetaB = std::acos(std::clamp(b.cosTheta, -1.0f, 1.0f));
+            glm::vec3 axisA = a.axis;
+            glm::vec3 axisB = b.axis;
+
+            if (thetaB > thetaA) {
+                std::swap(thetaA, thetaB);
+                std::swap(axisA, axisB);
+            }
+
+            const float thetaD = std::acos(std::clamp(glm::dot(axisA, axisB), -1.0f, 1.0f));
+            if (std::min(thetaD + thetaB, pi) <= thetaA)
+                return std::make_pair(axisA, thetaA);
+
+            const float thetaO = 0.5f * (thetaA + thetaD + thetaB);
+            const glm::vec3 normal = glm::cross(axisA, axisB);
+            if (thetaO >= pi || glm::dot(normal, normal) < 1e-12f)
+                return std::make_pair(axisA, pi);
+
+            return std::make_pair(glm::normalize(rotate(axisA, glm::normalize(normal), thetaO - thetaA)), thetaO);
+        };
+
+        std::vector<VRAM_LightNode> leaves(lights.size());
+        std::vector<glm::vec3> centroids(lights.size());
+        for (size_t iter = 0; iter < lights.size(); iter++) {
+            auto const & light = lights[iter];
+            auto& leaf = leaves[iter];
+
+            const glm::vec3 far = light.a + light.ab + light.ac;
+            leaf.lo = glm::min(glm::min(light.a, far), glm::min(light.a + light.ab, light.a + light.ac));
+            leaf.hi = glm::max(glm::max(light.a, far), glm::max(light.a + light.ab, light.a + light.ac));
+            leaf.power = std::max(0.0f, light.intensity * glm::length(glm::cross(light.ab, light.ac)));
+            leaf.child = static_cast<uint32_t>(iter) | eLightLeaf;
+            leaf.axis = light.normal;
+            leaf.cosTheta = 1.0f;
+
+            centroids[iter] = 0.5f * (leaf.lo + leaf.hi);
+        }
+
+        std::vector<uint32_t> order(lights.size());
+        for (uint32_t iter = 0; iter < order.size(); iter++)
+            order[iter] = iter;
+
+        std::vector<VRAM_LightNode> nodes;
+        nodes.reserve(2 * lights.size() - 1);
+
+        std::function<uint32_t(size_t, size_t)> build = [&](size_t begin, size_t end) -> uint32_t {
+            const uint32_t node = nodes.size();
+
+            if (end - begin == 1) {
+                nodes.push_back(leaves[order[begin]]);
+                return node;
+            }
+
+            nodes.emplace_back();
+
+            glm::vec3 lo(std::numeric_limits<float>::max());
+            glm::vec3 hi(std::numeric_limits<float>::lowest());
+            for (size_t iter = begin; iter < end; iter++) {
+                lo = glm::min(lo, centroids[order[iter]]);
+                hi = glm::max(hi, centroids[order[iter]]);
+            }
+
+            const glm::vec3 extent = hi - lo;
+            const int axis = (extent.x >= extent.y && extent.x >= extent.z) ? 0 : (extent.y >= extent.z) ? 1 : 2;
+            const size_t middle = begin + (end - begin) / 2;
+
+            std::nth_element(order.begin() + begin, order.begin() + middle, order.begin() + end,
+                    [&](uint32_t a, uint32_t b) { return centroids[a][axis] < centroids[b][axis]; });
+
+            build(begin, middle);
+            const uint32_t second = build(middle, end);
+
+            auto const & first = nodes[node + 1];
+            auto const & other = nodes[second];
+            auto [coneAxis, coneTheta] = cone(first, other);
+
+            auto& inner = nodes[node];
+            inner.lo = glm::min(first.lo, other.lo);
+            inner.hi = glm::max(first.hi, other.hi);
+            inner.power = first.power + other.power;
+            inner.child = second;
+            inner.axis = coneAxis;
+            inner.cosTheta = std::cos(coneTheta);
+
+            return node;
+        };
+
+        build(0, lights.size());
+
+        return nodes;
+    }
+
+    LightPadInfo Model_t::generateUnitLightPad() {
+        return generateLightPad({ .dims = glm::vec2(1.0f) });
+    }
+
+    size_t Model_t::mergeStatic(MergeInfo const & info, ThreadPool pool) {
+        struct Candidate {
+            uint32_t instance;
+            uint32_t triangles;
+            glm::vec3 centroid;
+        };
+
+        // Object space bounds of every mesh, placed by the instance transforms below
+        std::vector<std::pair<glm::vec3, glm::vec3>> bounds(meshes.size());
+        for (size_t iter = 0; iter < meshes.size(); iter++) {
+            glm::vec3 lo(std::numeric_limits<float>::max());
+            glm::vec3 hi(std::numeric_limits<float>::lowest());
+
+            for (auto const & vertex : meshes[iter].vertexData()) {
+                lo = glm::min(lo, vertex.pos);
+                hi = glm::max(hi, vertex.pos);
+            }
+
+            bounds[iter] = { lo, hi };
+        }
+
+        std::vector<Candidate> candidates;
+        for (uint32_t iter = 0; iter < instances.size(); iter++) {
+            auto const & instance = instances[iter];
+            auto const & mesh = meshes[instance.mesh];
+            const uint32_t triangles = mesh.indexData().size() / 3;
+
+            if (triangles == 0 || triangles > info.smallMesh || !mesh.primitiveMeshes.empty())
+                continue;
+
+            auto const & [lo, hi] = bounds[instance.mesh];
+            glm::vec3 worldLo(std::numeric_limits<float>::max());
+            glm::vec3 worldHi(std::numeric_limits<float>::lowest());
+
+            for (uint32_t corner = 0; corner < 8; corner++) {
+                const glm::vec3 local((corner & 1) ? hi.x : lo.x, (corner & 2) ? hi.y : lo.y, (corner & 4) ? hi.z : lo.z);
+                const glm::vec3 world = glm::vec3(instance.transform * glm::vec4(local, 1.0f));
+
+                worldLo = glm::min(worldLo, world);
+                worldHi = glm::max(worldHi, world);
+            }
+
+            candidates.push_back({ iter, triangles, 0.5f * (worldLo + worldHi) });
+        }
+
+        if (candidates.size() < 2)
+            return 0;
+
+        // Median splits along the widest axis of the centroids until every cluster fits
+        std::vector<std::pair<size_t, size_t>> clusters;
+        std::vector<std::pair<size_t, size_t>> stack{ { 0, candidates.size() } };
+
+        while (!stack.empty()) {
+            auto [begin, end] = stack.back();
+            stack.pop_back();
+
+            size_t triangles = 0;
+            glm::vec3 lo(std::numeric_limits<float>::max());
+            glm::vec3 hi(std::numeric_limits<float>::lowest());
+
+            for (size_t iter = begin; iter < end; iter++) {
+                triangles += candidates[iter].triangles;
+                lo = glm::min(lo, candidates[iter].centroid);
+                hi = glm::max(hi, candidates[iter].centroid);
+            }
+
+            if (triangles <= info.clusterTriangles || end - begin < 2) {
+                clusters.emplace_back(begin, end);
+                continue;
+            }
+
+            const glm::vec3 extent = hi - lo;
+            const int axis = (extent.x >= extent.y && extent.x >= extent.z) ? 0 : (extent.y >= extent.z) ? 1 : 2;
+            const size_t middle = begin + (end - begin) / 2;
+
+            std::nth_element(candidates.begin() + begin, candidates.begin() + middle, candidates.begin() + end,
+                    [axis](Candidate const & a, Candidate const & b) { return a.centroid[axis] < b.centroid[axis]; });
+
+            stack.emplace_back(begin, middle);
+            stack.emplace_back(middle, end);
+        }
+
+        // A lone instance gains nothing from being merged
+        std::erase_if(clusters, [](auto const & cluster) { return cluster.second - cluster.first < 2; });
+
+        if (clusters.empty())
+            return 0;
+
+        std::vector<Mesh> merged(clusters.size());
+
+        auto merge = [&](size_t iter) {
+            auto [begin, end] = clusters[iter];
+            auto& mesh = merged[iter];
+
+            size_t vertexCount = 0;
+            size_t indexCount = 0;
+            for (size_t cand = begin; cand < end; cand++) {
+                auto const & source = meshes[instances[candidates[cand].instance].mesh];
+                vertexCount += source.vertexData().size();
+                indexCount += source.indexData().size();
+            }
+
+            mesh.vertices.reserve(vertexCount);
+            mesh.indices.reserve(indexCount);
+            mesh.primitiveMeshes.reserve(indexCount / 3);
+
+            for (size_t cand = begin; cand < end; cand++) {
+                auto const & instance = instances[candidates[cand].instance];
+                auto const & source = meshes[instance.mesh];
+
+                const glm::mat3 linear(instance.transform);
+                const glm::mat3 normalMatrix = glm::transpose(glm::inverse(linear));
+                const uint32_t base = mesh.vertices.size();
+
+                for (auto vertex : source.vertexData()) {
+                    vertex.pos = glm::vec3(instance.transform * glm::vec4(vertex.pos, 1.0f));
+                    vertex.normals = glm::normalize(normalMatrix * vertex.normals);
+                    vertex.tangent = linear * vertex.tangent;
+                    vertex.bitangent = linear * vertex.bitangent;
+                    mesh.vertices.push_back(vertex);
+                }
+
+                for (auto index : source.indexData())
+                    mesh.indices.push_back(base + index);
+
+                mesh.primitiveMeshes.insert(mesh.primitiveMeshes.end(), source.indexData().size() / 3, instance.mesh);
+            }
+
+            // Only read for the layout, shading goes through primitiveMeshes
+            mesh.material = meshes[instances[candidates[begin].instance].mesh].material;
+        };
+
+        if (pool == nullptr)
+            for (size_t iter = 0; iter < merged.size(); iter++)
+                merge(iter);
+        else
+            pool->parallelFor(merged.size(), merge);
+
+        std::vector<bool> absorbed(instances.size(), false);
+        size_t count = 0;
+        for (auto [begin, end] : clusters) {
+            for (size_t cand = begin; cand < end; cand++)
+                absorbed[candidates[cand].instance] = true;
+            count += end - begin;
+        }
+
+        std::vector<Instance> kept;
+        kept.reserve(instances.size() - count + merged.size());
+        for (size_t iter = 0; iter < instances.size(); iter++)
+            if (!absorbed[iter])
+                kept.push_back(instances[iter]);
+
+        for (auto& mesh : merged) {
+            kept.push_back({ glm::mat4(1.0f), static_cast<uint32_t>(meshes.size()) });
+            meshes.push_back(std::move(mesh));
+        }
+
+        instances = std::move(kept);
+
+        // Sources stay for their materials, their geometry only costs memory now
+        std::vector<bool> used(meshes.size(), false);
+        for (auto const & instance : instances)
+            used[instance.mesh] = true;
+
+        for (size_t iter = 0; iter < meshes.size(); iter++) {
+            if (used[iter])
+                continue;
+
+            meshes[iter].vertices = {};
+            meshes[iter].indices = {};
+            meshes[iter].mappedVertices = {};
+            meshes[iter].mappedIndices = {};
+        }
+
+        return count;
+    }
+
+    size_t Model_t::weld(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices) {
+        constexpr uint32_t empty = std::numeric_limits<uint32_t>::max();
+
+        // Open addressing with linear probing, kept at most half full
+        size_t capacity = 16;
+        while (capacity < vertices.size() * 2)
+            capacity <<= 1;
+        const size_t mask = capacity - 1;
+
+        std::vector<uint32_t> table(capacity, empty);
+        std::vector<uint32_t> remap(vertices.size());
+
+        std::hash<Vertex> hasher;
+        size_t unique = 0;
+        for (size_t iter = 0; iter < vertices.size(); iter++) {
+            // std::hash<glm::vec> only xors, spread the bits before masking
+            size_t slot = (hasher(vertices[iter]) * 0x9E3779B97F4A7C15ull) >> 20 & mask;
+
+            while (table[slot] != empty && !(vertices[table[slot]] == vertices[iter]))
+                slot = (slot + 1) & mask;
+
+            if (table[slot] == empty) {
+                vertices[unique] = vertices[iter];
+                table[slot] = unique++;
+            }
+
+            remap[iter] = table[slot];
+        }
+
+        vertices.resize(unique);
+        vertices.shrink_to_fit();
+
+        for (auto& index : indices)
+            index = remap[index];
+
+        return unique;
+    }
 }
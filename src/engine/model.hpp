@@ -5,9 +5,13 @@
 #include <assimp/postprocess.h>
 
 #include <hdvw/vertex.hpp>
-#include <hdvw/texture.hpp>
+#include <engine/threadpool.hpp>
+#include <engine/texturecache.hpp>
+#include <engine/mappedfile.hpp>
 
 #include <memory>
+#include <span>
+#include <string>
 #include <string_view>
 #include <iostream>
 #include <functional>
@@ -24,6 +28,8 @@ namespace hd {
         float dissolve;
         int shadingModel;
         int diffuseMapCount;
+        int diffuseIndex; // Slot in the texture cache
+        float uvDensity; // UV units per world unit, picks the texture LOD
     };
 
     struct Light {
@@ -35,6 +41,16 @@ namespace hd {
         glm::vec3 rotate;
     };
 
+    // Packed light list, a LightFileHeader followed by Light[lightCount]
+    struct LightFileHeader {
+        static constexpr uint32_t currentVersion = 1;
+
+        char magic[8];
+        uint32_t version;
+        uint32_t lightSize;
+        uint64_t lightCount;
+    };
+
     struct VRAM_Light {
         glm::vec3 color;
         float intensity;
@@ -44,23 +60,89 @@ namespace hd {
         glm::vec3 ac;
     };
 
+    // Walker alias table over light power, entry i is drawn with probability 1 / lightCount and keeps
+    // light i with probability prob, otherwise it yields alias
+    struct VRAM_AliasEntry {
+        float prob;
+        uint32_t alias;
+        float pdf; // Chance to pick light i relative to a uniform pick, 1 when every light is as strong
+    };
+
+    // Light BVH in depth first order, an inner node is followed by its first child. Bounds, power and the
+    // normal cone cover every light below the node.
+    struct VRAM_LightNode {
+        glm::vec3 lo;
+        float power;
+        glm::vec3 hi;
+        uint32_t child; // Second child of an inner node, light | eLightLeaf for a leaf
+        glm::vec3 axis;
+        float cosTheta;
+    };
+
+    enum VRAM_LightNodeFlags : uint32_t {
+        eLightLeaf = 1u << 31,
+    };
+
+    // Device addresses of a mesh inside the merged buffers, indexed by gl_InstanceCustomIndexEXT
+    struct VRAM_Geometry {
+        uint64_t vertices; // PackedVertex[]
+        uint64_t indices;
+        uint64_t material;
+        uint64_t primitives; // uint32_t[] source mesh of every triangle, eGeometryMerged only
+        uint32_t flags;
+        uint32_t reserved;
+    };
+
+    enum VRAM_GeometryFlags : uint32_t {
+        eGeometryShortIndices = 1 << 0, // Two 16 bit indices per word, low half first
+        eGeometryMerged = 1 << 1, // Materials come from the geometry of the source mesh of each triangle
+    };
+
     struct Mesh {
         std::vector<Vertex> vertices;
         std::vector<uint32_t> indices;
-        std::vector<Texture> diffuse;
+        std::vector<uint32_t> diffuse; // Texture cache slots
+        std::vector<std::string> diffusePaths;
         Material material = {};
+        std::vector<uint32_t> primitiveMeshes; // Merged meshes only, source mesh of every triangle
+
+        // Scene cache hits point these into the mapped file and leave vertices and indices empty
+        std::span<const Vertex> mappedVertices;
+        std::span<const uint32_t> mappedIndices;
+
+        inline std::span<const Vertex> vertexData() const {
+            return mappedVertices.empty() ? std::span<const Vertex>(vertices) : mappedVertices;
+        }
+
+        inline std::span<const uint32_t> indexData() const {
+            return mappedIndices.empty() ? std::span<const uint32_t>(indices) : mappedIndices;
+        }
+    };
+
+    // Places meshes[mesh] in the world, several instances may share one mesh
+    struct Instance {
+        glm::mat4 transform;
+        uint32_t mesh;
     };
 
     struct ModelCreateInfo {
         std::string_view filename;
-        std::function<Texture(const char*)> textureConjure;
+        TextureCache textures;
         bool multiply = false;
+        bool weld = false;
+        ThreadPool pool = nullptr;
+    };
+
+    struct MergeInfo {
+        uint32_t smallMesh = 4096; // Instances of meshes with at most this many triangles get merged
+        uint32_t clusterTriangles = 1 << 16; // Clusters are split until they fit
     };
 
     struct LightPadInfo {
         std::vector<Vertex> vertices;
         std::vector<uint32_t> indices;
         VRAM_Light props;
+        glm::mat4 transform; // Unit pad to world
     };
 
     class Model_t;
@@ -68,24 +150,68 @@ namespace hd {
 
     class Model_t {
         private:
-            std::function<Texture(const char*)> textureConjure;
-
-            void processNode(aiNode *node, const aiScene *scene, bool multiply);
+            void processNode(aiNode *node, glm::mat4 const & parent);
 
             Mesh processMesh(aiMesh *mesh, const aiScene *scene);
 
         public:
             std::vector<Mesh> meshes;
+            std::vector<Instance> instances;
+            MappedFile mapping; // Backs the mapped spans of the meshes
 
             static Model conjure(ModelCreateInfo const & ci) {
                 return std::make_shared<Model_t>(ci);
             }
 
+            static Model conjure(std::vector<Mesh>&& meshes, std::vector<Instance>&& instances) {
+                return std::make_shared<Model_t>(std::move(meshes), std::move(instances));
+            }
+
+            // Accepts a scene .json or a packed .lights file, throws with the location of any error
             static std::vector<Light> parseLights(std::string_view filename, bool multiply = false);
 
+            static std::vector<Light> loadLights(std::string_view filename);
+
+            static void storeLights(std::string_view filename, std::vector<Light> const & lights);
+
+            // Average UV to world scale of a triangle list
+            static float uvDensity(std::vector<Vertex> const & vertices, std::vector<uint32_t> const & indices);
+
+            // Fills mesh.diffuse and the material texture slot from mesh.diffusePaths, without a cache mesh.diffuse stays empty
+            static void requestTextures(Mesh& mesh, TextureCache textures);
+
             static LightPadInfo generateLightPad(Light light);
 
+            // Batched generateLightPad without the geometry, writes props[i] and transforms[i] for lights[i].
+            // Transforms are row major 3x4 like VkTransformMatrixKHR and place generateUnitLightPad().
+            // Both outputs stay arrays of records, they are copied to the GPU as they are: props is the Lights
+            // buffer the shaders index and transforms feed placeLightPads() and the instance records.
+            static void generateLightPads(std::span<const Light> lights, std::span<VRAM_Light> props, std::span<glm::mat3x4> transforms, ThreadPool pool = nullptr);
+
+            // World space copies of pad for every transform, positions[i * pad.size() + k] is pad[k] placed by transforms[i]
+            static void placeLightPads(std::span<const glm::mat3x4> transforms, std::span<const glm::vec3> pad, std::span<glm::vec3> positions, ThreadPool pool = nullptr);
+
+            // Power is intensity times pad area. Lights without power are never picked, unless none has any.
+            static std::vector<VRAM_AliasEntry> buildAliasTable(std::span<const VRAM_Light> lights);
+
+            // One leaf per light, split at the median of the widest axis. Power matches buildAliasTable.
+            static std::vector<VRAM_LightNode> buildLightTree(std::span<const VRAM_Light> lights);
+
+            // 1x1 pad around the origin, every light places it with LightPadInfo::transform
+            static LightPadInfo generateUnitLightPad();
+
+            // Replaces spatially close instances of small meshes by world space meshes, one identity instance
+            // per cluster. Meshes left without instances keep their material but drop their geometry,
+            // no instance references a mesh with empty geometry afterwards.
+            // Returns the number of instances that were merged.
+            size_t mergeStatic(MergeInfo const & info, ThreadPool pool = nullptr);
+
+            // Merges bit-identical vertices and rewrites indices, returns the number of vertices left
+            static size_t weld(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
+
             Model_t(ModelCreateInfo const & ci);
+
+            Model_t(std::vector<Mesh>&& meshes, std::vector<Instance>&& instances);
     };
 
     inline Model conjure(ModelCreateInfo const & ci) {
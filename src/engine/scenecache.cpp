@@ -0,0 +1,252 @@
+#include <scenecache.hpp>
+
+#include <filesystem>
+#include <fstream>
+#include <cstring>
+
+namespace hd {
+    static constexpr char sceneCacheMagic[8] = { 'H', 'D', 'S', 'C', 'E', 'N', 'E', '\0' };
+
+    uint32_t SceneCache_t::flags(SceneCacheCreateInfo const & ci) {
+        uint32_t ret = 0;
+
+        if (ci.multiply)
+            ret |= eSceneCacheMultiply;
+
+        if (ci.weld)
+            ret |= eSceneCacheWeld;
+
+        return ret;
+    }
+
+    uint64_t SceneCache_t::sourceHash(SceneCacheCreateInfo const & ci) {
+        return std::hash<std::string>()(std::string(ci.modelFilename) + '\n' + std::string(ci.lightsFilename));
+    }
+
+    bool SceneCache_t::stale(SceneCacheCreateInfo const & ci) {
+        namespace fs = std::filesystem;
+
+        std::error_code error;
+        auto cached = fs::last_write_time(ci.filename, error);
+        if (error)
+            return true;
+
+        auto mtl = fs::path(ci.modelFilename).replace_extension(".mtl");
+        for (auto const & source : { fs::path(ci.modelFilename), mtl, fs::path(ci.lightsFilename) }) {
+            auto modified = fs::last_write_time(source, error);
+            if (error)
+                continue;
+
+            if (modified > cached)
+                return true;
+        }
+
+        return false;
+    }
+
+    bool SceneCache_t::load(SceneCacheCreateInfo const & ci) {
+        auto file = hd::conjure(MappedFileCreateInfo{ .filename = ci.filename });
+
+        if (file->size() < sizeof(SceneCacheHeader))
+            return false;
+
+        auto header = file->at<SceneCacheHeader>(0);
+        if (memcmp(header->magic, sceneCacheMagic, sizeof(sceneCacheMagic)) != 0
+                || header->version != version
+                || header->flags != flags(ci)
+                || header->sourceHash != sourceHash(ci)
+                || header->vertexSize != sizeof(Vertex)
+                || header->materialSize != sizeof(Material)
+                || header->lightSize != sizeof(Light)
+                || header->instanceSize != sizeof(Instance)
+                || header->fileSize != file->size())
+            return false;
+
+        auto fits = [&](uint64_t offset, uint64_t count, uint64_t stride) {
+            return offset <= file->size() && count <= (file->size() - offset) / stride;
+        };
+
+        if (!fits(sizeof(SceneCacheHeader), header->meshCount, sizeof(SceneCacheMesh))
+                || !fits(header->lightOffset, header->lightCount, sizeof(Light))
+                || !fits(header->instanceOffset, header->instanceCount, sizeof(Instance)))
+            return false;
+
+        auto records = file->at<SceneCacheMesh>(sizeof(SceneCacheHeader));
+
+        std::vector<Mesh> meshes(header->meshCount);
+        for (uint32_t iter = 0; iter < header->meshCount; iter++) {
+            auto const & record = records[iter];
+            auto& mesh = meshes[iter];
+
+            if (!fits(record.vertexOffset, record.vertexCount, sizeof(Vertex))
+                    || !fits(record.indexOffset, record.indexCount, sizeof(uint32_t))
+                    || !fits(record.textureOffset, record.textureCount, sizeof(SceneCacheString)))
+                return false;
+
+            // Geometry stays in the mapping, the upload packs it from there
+            mesh.mappedVertices = { file->at<Vertex>(record.vertexOffset), record.vertexCount };
+            mesh.mappedIndices = { file->at<uint32_t>(record.indexOffset), record.indexCount };
+
+            mesh.material = record.material;
+
+            auto textures = file->at<SceneCacheString>(record.textureOffset);
+            mesh.diffusePaths.reserve(record.textureCount);
+            for (uint64_t tex = 0; tex < record.textureCount; tex++) {
+                if (!fits(textures[tex].offset, textures[tex].length, 1))
+                    return false;
+
+                mesh.diffusePaths.emplace_back(file->at<char>(textures[tex].offset), textures[tex].length);
+            }
+        }
+
+        // Slots depend on the texture cache of this run, so they are never persisted
+        for (auto& mesh : meshes)
+            Model_t::requestTextures(mesh, ci.textures);
+
+        _mappedLights = { file->at<Light>(header->lightOffset), header->lightCount };
+
+        auto instances = file->at<Instance>(header->instanceOffset);
+        std::vector<Instance> placed(instances, instances + header->instanceCount);
+
+        for (auto const & instance : placed) {
+            if (instance.mesh >= meshes.size())
+                return false;
+        }
+
+        _model = Model_t::conjure(std::move(meshes), std::move(placed));
+        _model->mapping = file;
+        _file = file;
+        return true;
+    }
+
+    void SceneCache_t::store(SceneCacheCreateInfo const & ci) {
+        auto align = [](uint64_t offset) {
+            return (offset + 15) & ~uint64_t(15);
+        };
+
+        auto& meshes = _model->meshes;
+
+        SceneCacheHeader header{};
+        memcpy(header.magic, sceneCacheMagic, sizeof(sceneCacheMagic));
+        header.version = version;
+        header.flags = flags(ci);
+        header.sourceHash = sourceHash(ci);
+        header.vertexSize = sizeof(Vertex);
+        header.materialSize = sizeof(Material);
+        header.lightSize = sizeof(Light);
+        header.instanceSize = sizeof(Instance);
+        header.meshCount = meshes.size();
+        header.lightCount = _lights.size();
+        header.instanceCount = _model->instances.size();
+
+        // Lay out the file before writing anything
+        std::vector<SceneCacheMesh> records(meshes.size());
+        std::vector<std::vector<SceneCacheString>> strings(meshes.size());
+
+        uint64_t offset = sizeof(SceneCacheHeader) + sizeof(SceneCacheMesh) * records.size();
+        header.lightOffset = offset = align(offset);
+        offset += sizeof(Light) * _lights.size();
+
+        header.instanceOffset = offset = align(offset);
+        offset += sizeof(Instance) * _model->instances.size();
+
+        for (uint32_t iter = 0; iter < meshes.size(); iter++) {
+            records[iter].vertexOffset = offset = align(offset);
+            records[iter].vertexCount = meshes[iter].vertexData().size();
+            offset += sizeof(Vertex) * meshes[iter].vertexData().size();
+
+            records[iter].indexOffset = offset = align(offset);
+            records[iter].indexCount = meshes[iter].indexData().size();
+            offset += sizeof(uint32_t) * meshes[iter].indexData().size();
+
+            records[iter].textureOffset = offset = align(offset);
+            records[iter].textureCount = meshes[iter].diffusePaths.size();
+            offset += sizeof(SceneCacheString) * meshes[iter].diffusePaths.size();
+
+            records[iter].material = meshes[iter].material;
+        }
+
+        for (uint32_t iter = 0; iter < meshes.size(); iter++) {
+            for (auto const & path : meshes[iter].diffusePaths) {
+                strings[iter].push_back({ offset, path.size() });
+                offset += path.size() + 1;
+            }
+        }
+
+        header.fileSize = offset;
+
+        // Write into a sibling file and swap it in, so a crashed run never leaves a torn cache behind
+        auto temporary = std::filesystem::path(ci.filename).concat(".tmp");
+        std::ofstream file(temporary, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            std::cerr << "Couldn't write scene cache " << ci.filename << std::endl;
+            return;
+        }
+
+        auto pad = [&]() {
+            static const char zeroes[16] = {};
+            uint64_t position = file.tellp();
+            file.write(zeroes, align(position) - position);
+        };
+
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(records.data()), sizeof(SceneCacheMesh) * records.size());
+
+        pad();
+        file.write(reinterpret_cast<const char*>(_lights.data()), sizeof(Light) * _lights.size());
+
+        pad();
+        file.write(reinterpret_cast<const char*>(_model->instances.data()), sizeof(Instance) * _model->instances.size());
+
+        for (uint32_t iter = 0; iter < meshes.size(); iter++) {
+            pad();
+            file.write(reinterpret_cast<const char*>(meshes[iter].vertexData().data()), sizeof(Vertex) * meshes[iter].vertexData().size());
+            pad();
+            file.write(reinterpret_cast<const char*>(meshes[iter].indexData().data()), sizeof(uint32_t) * meshes[iter].indexData().size());
+            pad();
+            file.write(reinterpret_cast<const char*>(strings[iter].data()), sizeof(SceneCacheString) * strings[iter].size());
+        }
+
+        for (uint32_t iter = 0; iter < meshes.size(); iter++) {
+            for (auto const & path : meshes[iter].diffusePaths)
+                file.write(path.c_str(), path.size() + 1);
+        }
+
+        file.close();
+
+        std::error_code error;
+        std::filesystem::rename(temporary, ci.filename, error);
+        if (error)
+            std::cerr << "Couldn't write scene cache " << ci.filename << ": " << error.message() << std::endl;
+    }
+
+    SceneCache_t::SceneCache_t(SceneCacheCreateInfo const & ci) {
+        if (!ci.rebuild && !stale(ci)) {
+            try {
+                _hit = load(ci);
+            } catch (std::exception const & e) {
+                std::cerr << "Scene cache " << ci.filename << " is unreadable: " << e.what() << std::endl;
+                _hit = false;
+            }
+        }
+
+        if (_hit)
+            return;
+
+        _lights.clear();
+        _model = Model_t::conjure(ModelCreateInfo{
+                .filename = ci.modelFilename,
+                .textures = ci.textures,
+                .multiply = ci.multiply,
+                .weld = ci.weld,
+                .pool = ci.pool,
+                });
+        _lights = Model_t::parseLights(ci.lightsFilename, ci.multiply);
+
+        // Assimp failures leave the model empty, don't persist those
+        if (_model->meshes.empty())
+            return;
+
+        store(ci);
+    }
+}
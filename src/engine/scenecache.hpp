@@ -0,0 +1,115 @@
+#pragma once
+
+#include <engine/model.hpp>
+#include <engine/mappedfile.hpp>
+
+#include <memory>
+#include <string_view>
+#include <functional>
+#include <vector>
+#include <span>
+
+namespace hd {
+    // Cooked scene layout, every offset is relative to the start of the file:
+    //   SceneCacheHeader
+    //   SceneCacheMesh[meshCount]
+    //   Light[lightCount]
+    //   Instance[instanceCount]
+    //   per mesh: Vertex[vertexCount], uint32_t[indexCount], SceneCacheString[textureCount]
+    //   string blob
+    struct SceneCacheHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t flags;
+        uint32_t vertexSize;
+        uint32_t materialSize;
+        uint32_t lightSize;
+        uint32_t instanceSize;
+        uint32_t meshCount;
+        uint64_t sourceHash; // Model and light file names
+        uint64_t lightCount;
+        uint64_t lightOffset;
+        uint64_t instanceCount;
+        uint64_t instanceOffset;
+        uint64_t fileSize;
+    };
+
+    struct SceneCacheMesh {
+        uint64_t vertexOffset;
+        uint64_t vertexCount;
+        uint64_t indexOffset;
+        uint64_t indexCount;
+        uint64_t textureOffset;
+        uint64_t textureCount;
+        Material material;
+    };
+
+    struct SceneCacheString {
+        uint64_t offset;
+        uint64_t length;
+    };
+
+    enum SceneCacheFlags : uint32_t {
+        eSceneCacheMultiply = 1 << 0,
+        eSceneCacheWeld = 1 << 1,
+    };
+
+    struct SceneCacheCreateInfo {
+        std::string_view filename;
+        std::string_view modelFilename;
+        std::string_view lightsFilename;
+        TextureCache textures;
+        bool multiply = false;
+        bool weld = false;
+        bool rebuild = false;
+        ThreadPool pool = nullptr;
+    };
+
+    class SceneCache_t;
+    typedef std::shared_ptr<SceneCache_t> SceneCache;
+
+    class SceneCache_t {
+        private:
+            static constexpr uint32_t version = 3;
+
+            Model _model;
+            std::vector<Light> _lights; // Parsed on a miss
+            MappedFile _file; // Backs _mappedLights on a hit, the model keeps its own reference for the meshes
+            std::span<const Light> _mappedLights;
+            bool _hit = false;
+
+            uint32_t flags(SceneCacheCreateInfo const & ci);
+
+            uint64_t sourceHash(SceneCacheCreateInfo const & ci);
+
+            bool stale(SceneCacheCreateInfo const & ci);
+
+            bool load(SceneCacheCreateInfo const & ci);
+
+            void store(SceneCacheCreateInfo const & ci);
+
+        public:
+            static SceneCache conjure(SceneCacheCreateInfo const & ci) {
+                return std::make_shared<SceneCache_t>(ci);
+            }
+
+            SceneCache_t(SceneCacheCreateInfo const & ci);
+
+            inline auto model() {
+                return _model;
+            }
+
+            // Points into the mapped file on a hit, valid as long as this cache
+            inline std::span<const Light> lights() {
+                return _hit ? _mappedLights : std::span<const Light>(_lights);
+            }
+
+            inline auto hit() {
+                return _hit;
+            }
+    };
+
+    inline SceneCache conjure(SceneCacheCreateInfo const & ci) {
+        return SceneCache_t::conjure(ci);
+    }
+}
@@ -0,0 +1,82 @@
+#include <texturecache.hpp>
+
+#include <filesystem>
+
+namespace hd {
+    TextureCache_t::TextureCache_t(TextureCacheCreateInfo const & ci) {
+        _commandPool = ci.commandPool;
+        _queue = ci.queue;
+        _allocator = ci.allocator;
+        _device = ci.device;
+        _pool = (ci.pool != nullptr) ? ci.pool : ThreadPool_t::conjure({});
+        _rebuild = ci.rebuild;
+
+        auto sampled = [&](vk::Format format) {
+            auto properties = _device->physical().getFormatProperties(format);
+            return static_cast<bool>(properties.optimalTilingFeatures & vk::FormatFeatureFlagBits::eSampledImage);
+        };
+
+        const bool compressed = _device->physical().getFeatures().textureCompressionBC;
+
+        _cookFormat = (compressed && sampled(vk::Format::eBc1RgbSrgbBlock))
+            ? vk::Format::eBc1RgbSrgbBlock : vk::Format::eR8G8B8A8Srgb;
+        _sampleBC7 = compressed && sampled(vk::Format::eBc7SrgbBlock);
+    }
+
+    uint32_t TextureCache_t::request(std::string_view filename) {
+        std::error_code error;
+        auto resolved = std::filesystem::weakly_canonical(filename, error);
+        std::string key = error ? std::string(filename) : resolved.string();
+
+        auto [slot, inserted] = _slots.emplace(key, _paths.size());
+        if (inserted)
+            _paths.emplace_back(filename);
+
+        return slot->second;
+    }
+
+    void TextureCache_t::load(UploadBatch batch) {
+        const size_t first = _textures.size();
+        const size_t pending = _paths.size() - first;
+        if (pending == 0)
+            return;
+
+        std::vector<TexturePixels> pixels(pending);
+        _pool->parallelFor(pending, [&](size_t iter) {
+            auto cooked = TextureCook_t::conjure({
+                    .source = _paths[first + iter],
+                    .format = _cookFormat,
+                    .sampleBC7 = _sampleBC7,
+                    .rebuild = _rebuild,
+                    });
+
+            pixels[iter] = std::move(cooked->pixels());
+        });
+
+        bool owned = (batch == nullptr);
+        if (owned) {
+            batch = UploadBatch_t::conjure({
+                    .commandPool = _commandPool,
+                    .queue = _queue,
+                    .allocator = _allocator,
+                    .device = _device,
+                    });
+        }
+
+        _textures.reserve(_paths.size());
+        for (size_t iter = 0; iter < pending; iter++) {
+            _textures.push_back(Texture_t::conjure({
+                    .filename = _paths[first + iter].c_str(),
+                    .commandPool = _commandPool,
+                    .queue = _queue,
+                    .allocator = _allocator,
+                    .device = _device,
+                    .pixels = &pixels[iter],
+                    .batch = batch,
+                    }));
+        }
+
+        if (owned)
+            batch->flush();
+    }
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <hdvw/texture.hpp>
+
+#include <engine/threadpool.hpp>
+#include <engine/texturecook.hpp>
+
+#include <memory>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace hd {
+    struct TextureCacheCreateInfo {
+        CommandPool commandPool;
+        Queue queue;
+        Allocator allocator;
+        Device device;
+        ThreadPool pool = nullptr;
+        bool rebuild = false; // Recooks every texture
+    };
+
+    class TextureCache_t;
+    typedef std::shared_ptr<TextureCache_t> TextureCache;
+
+    // Hands out one slot per unique file, textures() is indexed by these slots
+    class TextureCache_t {
+        private:
+            CommandPool _commandPool;
+            Queue _queue;
+            Allocator _allocator;
+            Device _device;
+            ThreadPool _pool;
+            vk::Format _cookFormat;
+            bool _sampleBC7;
+            bool _rebuild;
+
+            std::map<std::string, uint32_t> _slots;
+            std::vector<std::string> _paths;
+            std::vector<Texture> _textures;
+
+        public:
+            static TextureCache conjure(TextureCacheCreateInfo const & ci) {
+                return std::make_shared<TextureCache_t>(ci);
+            }
+
+            TextureCache_t(TextureCacheCreateInfo const & ci);
+
+            uint32_t request(std::string_view filename);
+
+            // Loads or cooks every pending request on the pool and records their uploads into batch,
+            // without one they are uploaded with a single submit of their own
+            void load(UploadBatch batch = nullptr);
+
+            inline auto const & textures() {
+                return _textures;
+            }
+
+            inline auto size() {
+                return static_cast<uint32_t>(_paths.size());
+            }
+    };
+
+    inline TextureCache conjure(TextureCacheCreateInfo const & ci) {
+        return TextureCache_t::conjure(ci);
+    }
+}
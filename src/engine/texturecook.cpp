@@ -0,0 +1,347 @@
+#include <texturecook.hpp>
+
+#include <engine/mappedfile.hpp>
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <cstring>
+#include <cmath>
+#include <array>
+#include <algorithm>
+#include <limits>
+
+namespace hd {
+    static constexpr char textureCookMagic[8] = { 'H', 'D', 'T', 'E', 'X', '\0', '\0', '\0' };
+
+    static uint64_t alignLevel(uint64_t offset) {
+        return (offset + 15) & ~uint64_t(15);
+    }
+
+    static const std::array<float, 256>& srgbToLinear() {
+        static const auto table = []() {
+            std::array<float, 256> ret;
+            for (uint32_t iter = 0; iter < 256; iter++) {
+                float c = iter / 255.0f;
+                ret[iter] = (c <= 0.04045f) ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+            }
+            return ret;
+        }();
+
+        return table;
+    }
+
+    static uint8_t linearToSrgb(float l) {
+        float c = (l <= 0.0031308f) ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+        return static_cast<uint8_t>(std::clamp(c * 255.0f + 0.5f, 0.0f, 255.0f));
+    }
+
+    // 2x2 box filter in linear space, odd edges reuse the last texel
+    static std::vector<uint8_t> downsample(std::vector<uint8_t> const & src, uint32_t width, uint32_t height) {
+        auto const & linear = srgbToLinear();
+
+        const uint32_t w = std::max(1u, width / 2), h = std::max(1u, height / 2);
+        std::vector<uint8_t> dst(w * h * 4);
+
+        for (uint32_t y = 0; y < h; y++) {
+            for (uint32_t x = 0; x < w; x++) {
+                const uint32_t x0 = std::min(2 * x, width - 1), x1 = std::min(2 * x + 1, width - 1);
+                const uint32_t y0 = std::min(2 * y, height - 1), y1 = std::min(2 * y + 1, height - 1);
+
+                const uint8_t* texels[4] = {
+                    &src[(y0 * width + x0) * 4], &src[(y0 * width + x1) * 4],
+                    &src[(y1 * width + x0) * 4], &src[(y1 * width + x1) * 4],
+                };
+
+                uint8_t* out = &dst[(y * w + x) * 4];
+                for (uint32_t c = 0; c < 3; c++) {
+                    float sum = 0.0f;
+                    for (auto texel : texels)
+                        sum += linear[texel[c]];
+                    out[c] = linearToSrgb(sum / 4.0f);
+                }
+
+                uint32_t alpha = 0;
+                for (auto texel : texels)
+                    alpha += texel[3];
+                out[3] = static_cast<uint8_t>((alpha + 2) / 4);
+            }
+        }
+
+        return dst;
+    }
+
+    static uint16_t pack565(uint8_t const * c) {
+        return static_cast<uint16_t>(((c[0] * 31 + 127) / 255) << 11 | ((c[1] * 63 + 127) / 255) << 5 | ((c[2] * 31 + 127) / 255));
+    }
+
+    static std::array<int, 3> unpack565(uint16_t c) {
+        int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+        return { (r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2) };
+    }
+
+    // Bounding box BC1 encoder, opaque four color blocks only
+    static void encodeBC1(std::vector<uint8_t> const & src, uint32_t width, uint32_t height, uint8_t* dst) {
+        const uint32_t blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+
+        for (uint32_t by = 0; by < blocksY; by++) {
+            for (uint32_t bx = 0; bx < blocksX; bx++) {
+                uint8_t block[16][3];
+                for (uint32_t iter = 0; iter < 16; iter++) {
+                    const uint32_t x = std::min(bx * 4 + iter % 4, width - 1);
+                    const uint32_t y = std::min(by * 4 + iter / 4, height - 1);
+                    memcpy(block[iter], &src[(y * width + x) * 4], 3);
+                }
+
+                uint8_t lo[3] = { 255, 255, 255 }, hi[3] = { 0, 0, 0 };
+                for (auto const & texel : block) {
+                    for (uint32_t c = 0; c < 3; c++) {
+                        lo[c] = std::min(lo[c], texel[c]);
+                        hi[c] = std::max(hi[c], texel[c]);
+                    }
+                }
+
+                // Pull the endpoints in a little, the box corners are rarely hit exactly
+                for (uint32_t c = 0; c < 3; c++) {
+                    const int inset = (hi[c] - lo[c]) / 16;
+                    lo[c] = static_cast<uint8_t>(lo[c] + inset);
+                    hi[c] = static_cast<uint8_t>(hi[c] - inset);
+                }
+
+                uint16_t c0 = pack565(hi), c1 = pack565(lo);
+                if (c0 < c1)
+                    std::swap(c0, c1);
+
+                uint32_t indices = 0;
+                if (c0 != c1) {
+                    const auto e0 = unpack565(c0), e1 = unpack565(c1);
+
+                    std::array<std::array<int, 3>, 4> palette;
+                    for (uint32_t c = 0; c < 3; c++) {
+                        palette[0][c] = e0[c];
+                        palette[1][c] = e1[c];
+                        palette[2][c] = (2 * e0[c] + e1[c]) / 3;
+                        palette[3][c] = (e0[c] + 2 * e1[c]) / 3;
+                    }
+
+                    for (uint32_t iter = 0; iter < 16; iter++) {
+                        uint32_t best = 0;
+                        int bestDistance = std::numeric_limits<int>::max();
+
+                        for (uint32_t p = 0; p < 4; p++) {
+                            int distance = 0;
+                            for (uint32_t c = 0; c < 3; c++) {
+                                const int d = block[iter][c] - palette[p][c];
+                                distance += d * d;
+                            }
+
+                            if (distance < bestDistance) {
+                                bestDistance = distance;
+                                best = p;
+                            }
+                        }
+
+                        indices |= best << (2 * iter);
+                    }
+                }
+
+                uint8_t* out = dst + (by * blocksX + bx) * 8;
+                memcpy(out + 0, &c0, 2);
+                memcpy(out + 2, &c1, 2);
+                memcpy(out + 4, &indices, 4);
+            }
+        }
+    }
+
+    uint64_t TextureCook_t::levelSize(vk::Format format, uint32_t width, uint32_t height) {
+        const uint64_t blocks = uint64_t((width + 3) / 4) * ((height + 3) / 4);
+
+        switch (format) {
+            case vk::Format::eR8G8B8A8Srgb:
+            case vk::Format::eR8G8B8A8Unorm:
+                return uint64_t(width) * height * 4;
+            case vk::Format::eBc1RgbSrgbBlock:
+            case vk::Format::eBc1RgbaSrgbBlock:
+            case vk::Format::eBc1RgbUnormBlock:
+            case vk::Format::eBc1RgbaUnormBlock:
+                return blocks * 8;
+            case vk::Format::eBc7SrgbBlock:
+            case vk::Format::eBc7UnormBlock:
+                return blocks * 16;
+            default:
+                return 0;
+        }
+    }
+
+    bool TextureCook_t::stale(TextureCookCreateInfo const & ci) {
+        namespace fs = std::filesystem;
+
+        std::error_code error;
+        auto cooked = fs::last_write_time(_filename, error);
+        if (error)
+            return true;
+
+        auto modified = fs::last_write_time(ci.source, error);
+        if (error)
+            return false;
+
+        return modified > cooked;
+    }
+
+    bool TextureCook_t::load(TextureCookCreateInfo const & ci) {
+        auto file = hd::conjure(MappedFileCreateInfo{ .filename = _filename });
+
+        if (file->size() < sizeof(TextureCookHeader))
+            return false;
+
+        auto header = file->at<TextureCookHeader>(0);
+        if (memcmp(header->magic, textureCookMagic, sizeof(textureCookMagic)) != 0
+                || header->version != version
+                || header->fileSize != file->size()
+                || header->width == 0 || header->height == 0
+                || header->levelCount == 0
+                || header->levelCount > (file->size() - sizeof(TextureCookHeader)) / sizeof(TextureCookLevel))
+            return false;
+
+        // The sampler and the image both assume a chain that halves from the full size down
+        uint32_t fullChain = 1;
+        for (uint32_t size = std::max(header->width, header->height); size > 1; size /= 2)
+            fullChain++;
+        if (header->levelCount > fullChain)
+            return false;
+
+        // BC cooks are redone when the device can't sample them, RGBA8 is taken as it is
+        const auto format = static_cast<vk::Format>(header->format);
+        if (format != ci.format && format != vk::Format::eR8G8B8A8Srgb && !(ci.sampleBC7 && format == vk::Format::eBc7SrgbBlock))
+            return false;
+
+        const uint64_t dataOffset = sizeof(TextureCookHeader) + sizeof(TextureCookLevel) * header->levelCount;
+        auto levels = file->at<TextureCookLevel>(sizeof(TextureCookHeader));
+
+        _pixels.width = header->width;
+        _pixels.height = header->height;
+        _pixels.format = format;
+        _pixels.levels.clear();
+
+        uint32_t width = header->width, height = header->height;
+        for (uint32_t iter = 0; iter < header->levelCount; iter++) {
+            auto const & level = levels[iter];
+
+            if (level.width != width || level.height != height)
+                return false;
+            width = std::max(1u, width / 2);
+            height = std::max(1u, height / 2);
+
+            if (level.offset < dataOffset || level.offset > file->size() || level.size > file->size() - level.offset
+                    || level.size != levelSize(format, level.width, level.height) || level.size == 0)
+                return false;
+
+            _pixels.levels.push_back({ .offset = level.offset - dataOffset, .width = level.width, .height = level.height });
+        }
+
+        // Level data goes to the staging buffer verbatim
+        auto data = file->at<uint8_t>(dataOffset);
+        _pixels.data.assign(data, data + (file->size() - dataOffset));
+
+        return true;
+    }
+
+    void TextureCook_t::cook(TextureCookCreateInfo const & ci) {
+        auto decoded = Texture_t::decode(std::string(ci.source).c_str());
+
+        auto format = ci.format;
+        for (size_t iter = 3; iter < decoded.data.size(); iter += 4) {
+            if (decoded.data[iter] != 255) {
+                format = vk::Format::eR8G8B8A8Srgb;
+                break;
+            }
+        }
+
+        _pixels.width = decoded.width;
+        _pixels.height = decoded.height;
+        _pixels.format = format;
+        _pixels.levels.clear();
+        _pixels.data.clear();
+
+        std::vector<uint8_t> level = std::move(decoded.data);
+        uint32_t width = decoded.width, height = decoded.height;
+
+        while (true) {
+            const uint64_t offset = alignLevel(_pixels.data.size());
+            _pixels.data.resize(offset + levelSize(format, width, height));
+            _pixels.levels.push_back({ .offset = offset, .width = width, .height = height });
+
+            if (format == vk::Format::eBc1RgbSrgbBlock)
+                encodeBC1(level, width, height, _pixels.data.data() + offset);
+            else
+                memcpy(_pixels.data.data() + offset, level.data(), level.size());
+
+            if (width == 1 && height == 1)
+                break;
+
+            level = downsample(level, width, height);
+            width = std::max(1u, width / 2);
+            height = std::max(1u, height / 2);
+        }
+    }
+
+    void TextureCook_t::store() {
+        const uint64_t dataOffset = sizeof(TextureCookHeader) + sizeof(TextureCookLevel) * _pixels.levels.size();
+
+        TextureCookHeader header{};
+        memcpy(header.magic, textureCookMagic, sizeof(textureCookMagic));
+        header.version = version;
+        header.format = static_cast<uint32_t>(_pixels.format);
+        header.width = _pixels.width;
+        header.height = _pixels.height;
+        header.levelCount = _pixels.levels.size();
+        header.fileSize = dataOffset + _pixels.data.size();
+
+        std::vector<TextureCookLevel> levels;
+        levels.reserve(_pixels.levels.size());
+        for (auto const & level : _pixels.levels) {
+            levels.push_back({
+                    .offset = dataOffset + level.offset,
+                    .size = levelSize(_pixels.format, level.width, level.height),
+                    .width = level.width,
+                    .height = level.height,
+                    });
+        }
+
+        auto temporary = std::filesystem::path(_filename).concat(".tmp");
+        std::ofstream file(temporary, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            std::cerr << "Couldn't write cooked texture " << _filename << std::endl;
+            return;
+        }
+
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(levels.data()), sizeof(TextureCookLevel) * levels.size());
+        file.write(reinterpret_cast<const char*>(_pixels.data.data()), _pixels.data.size());
+        file.close();
+
+        std::error_code error;
+        std::filesystem::rename(temporary, _filename, error);
+        if (error)
+            std::cerr << "Couldn't write cooked texture " << _filename << ": " << error.message() << std::endl;
+    }
+
+    TextureCook_t::TextureCook_t(TextureCookCreateInfo const & ci) {
+        _filename = std::string(ci.source) + ".hdtex";
+
+        if (!ci.rebuild && !stale(ci)) {
+            try {
+                _hit = load(ci);
+            } catch (std::exception const & e) {
+                std::cerr << "Cooked texture " << _filename << " is unreadable: " << e.what() << std::endl;
+                _hit = false;
+            }
+        }
+
+        if (_hit)
+            return;
+
+        cook(ci);
+        store();
+    }
+}
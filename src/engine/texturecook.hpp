@@ -0,0 +1,82 @@
+#pragma once
+
+#include <hdvw/texture.hpp>
+
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace hd {
+    // Cooked texture layout, every offset is relative to the start of the file:
+    //   TextureCookHeader
+    //   TextureCookLevel[levelCount]
+    //   level data, each level 16 byte aligned
+    struct TextureCookHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t format; // VkFormat
+        uint32_t width;
+        uint32_t height;
+        uint32_t levelCount;
+        uint32_t reserved;
+        uint64_t fileSize;
+    };
+
+    struct TextureCookLevel {
+        uint64_t offset;
+        uint64_t size;
+        uint32_t width;
+        uint32_t height;
+    };
+
+    struct TextureCookCreateInfo {
+        std::string_view source;
+        vk::Format format = vk::Format::eBc1RgbSrgbBlock; // eR8G8B8A8Srgb or eBc1RgbSrgbBlock
+        bool sampleBC7 = false; // BC7 containers cooked elsewhere are kept instead of recooked
+        bool rebuild = false;
+    };
+
+    class TextureCook_t;
+    typedef std::shared_ptr<TextureCook_t> TextureCook;
+
+    // Loads <source>.hdtex, cooking it from source first when it is missing or stale.
+    // Sources with translucent texels always fall back to RGBA8.
+    class TextureCook_t {
+        private:
+            static constexpr uint32_t version = 1;
+
+            std::string _filename;
+            TexturePixels _pixels;
+            bool _hit = false;
+
+            bool stale(TextureCookCreateInfo const & ci);
+
+            bool load(TextureCookCreateInfo const & ci);
+
+            void cook(TextureCookCreateInfo const & ci);
+
+            void store();
+
+        public:
+            static TextureCook conjure(TextureCookCreateInfo const & ci) {
+                return std::make_shared<TextureCook_t>(ci);
+            }
+
+            TextureCook_t(TextureCookCreateInfo const & ci);
+
+            // Byte size of one level, 0 for formats the loader doesn't know
+            static uint64_t levelSize(vk::Format format, uint32_t width, uint32_t height);
+
+            inline auto& pixels() {
+                return _pixels;
+            }
+
+            inline auto hit() {
+                return _hit;
+            }
+    };
+
+    inline TextureCook conjure(TextureCookCreateInfo const & ci) {
+        return TextureCook_t::conjure(ci);
+    }
+}
@@ -0,0 +1,43 @@
+#include <threadpool.hpp>
+
+namespace hd {
+    ThreadPool_t::ThreadPool_t(ThreadPoolCreateInfo const & ci) {
+        uint32_t threads = ci.threads;
+        if (threads == 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+
+        _workers.reserve(threads);
+        for (uint32_t iter = 0; iter < threads; iter++)
+            _workers.emplace_back(&ThreadPool_t::work, this);
+    }
+
+    void ThreadPool_t::work() {
+        while (true) {
+            std::function<void()> task;
+
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _condition.wait(lock, [this]() { return _stop || !_tasks.empty(); });
+
+                if (_stop && _tasks.empty())
+                    return;
+
+                task = std::move(_tasks.front());
+                _tasks.pop_front();
+            }
+
+            task();
+        }
+    }
+
+    ThreadPool_t::~ThreadPool_t() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _condition.notify_all();
+
+        for (auto& worker : _workers)
+            worker.join();
+    }
+}
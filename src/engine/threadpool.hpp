@@ -0,0 +1,90 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+namespace hd {
+    struct ThreadPoolCreateInfo {
+        uint32_t threads = 0; // 0 picks std::thread::hardware_concurrency()
+    };
+
+    class ThreadPool_t;
+    typedef std::shared_ptr<ThreadPool_t> ThreadPool;
+
+    class ThreadPool_t {
+        private:
+            std::vector<std::thread> _workers;
+            std::deque<std::function<void()>> _tasks;
+            std::mutex _mutex;
+            std::condition_variable _condition;
+            bool _stop = false;
+
+            void work();
+
+        public:
+            static ThreadPool conjure(ThreadPoolCreateInfo const & ci) {
+                return std::make_shared<ThreadPool_t>(ci);
+            }
+
+            ThreadPool_t(ThreadPoolCreateInfo const & ci);
+
+            inline auto size() {
+                return static_cast<uint32_t>(_workers.size());
+            }
+
+            template<class F>
+            auto submit(F&& f) {
+                using Result = std::invoke_result_t<F>;
+
+                auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(f));
+                auto future = task->get_future();
+
+                {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    _tasks.emplace_back([task]() { (*task)(); });
+                }
+                _condition.notify_one();
+
+                return future;
+            }
+
+            // Calls f(i) for every i in [0, count) and blocks until all of them are done.
+            // Must not be called from inside a task of the same pool.
+            template<class F>
+            void parallelFor(size_t count, F const & f) {
+                if (count == 0)
+                    return;
+
+                const size_t chunks = std::min<size_t>(count, size() * 4);
+                const size_t chunkSize = (count + chunks - 1) / chunks;
+
+                std::vector<std::future<void>> futures;
+                futures.reserve(chunks);
+
+                for (size_t begin = 0; begin < count; begin += chunkSize) {
+                    const size_t end = std::min(count, begin + chunkSize);
+
+                    futures.push_back(submit([&f, begin, end]() {
+                        for (size_t iter = begin; iter < end; iter++)
+                            f(iter);
+                    }));
+                }
+
+                for (auto& future : futures)
+                    future.get();
+            }
+
+            ~ThreadPool_t();
+    };
+
+    inline ThreadPool conjure(ThreadPoolCreateInfo const & ci) {
+        return ThreadPool_t::conjure(ci);
+    }
+}
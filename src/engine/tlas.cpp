@@ -1,5 +1,7 @@
 #include <tlas.hpp>
 
+#include <algorithm>
+
 namespace hd {
     TLAS_t::TLAS_t(TLASCreateInfo const & ci) {
          _device = ci.device->raw();
@@ -10,18 +12,25 @@ namespace hd {
         instances.arrayOfPointers = false;
         instances.data = ci.instbuffer->address().deviceAddress;
 
-        vk::AccelerationStructureGeometryKHR aStructGeometry{};
-        aStructGeometry.flags = vk::GeometryFlagBitsKHR::eOpaque;
-        aStructGeometry.geometryType = vk::GeometryTypeKHR::eInstances;
-        aStructGeometry.geometry.instances = instances;
+        _geometry.flags = vk::GeometryFlagBitsKHR::eOpaque;
+        _geometry.geometryType = vk::GeometryTypeKHR::eInstances;
+        _geometry.geometry.instances = instances;
+
+        _updatable = ci.allowUpdate;
+        _count = ci.instbuffer->count();
+        _capacity = std::max<uint32_t>(ci.maxInstances, _count);
+
+        _flags = vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace;
+        if (_updatable)
+            _flags |= vk::BuildAccelerationStructureFlagBitsKHR::eAllowUpdate;
 
         vk::AccelerationStructureBuildGeometryInfoKHR aStructGeometryBI{};
         aStructGeometryBI.type = vk::AccelerationStructureTypeKHR::eTopLevel;
-        aStructGeometryBI.flags = vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace;
-        aStructGeometryBI.setGeometries(aStructGeometry);
+        aStructGeometryBI.flags = _flags;
+        aStructGeometryBI.setGeometries(_geometry);
 
         vk::AccelerationStructureBuildSizesInfoKHR aStructSizesBI = _device.getAccelerationStructureBuildSizesKHR(
-                vk::AccelerationStructureBuildTypeKHR::eDevice, aStructGeometryBI, ci.instbuffer->count());
+                vk::AccelerationStructureBuildTypeKHR::eDevice, aStructGeometryBI, _capacity);
 
         vk::BufferCreateInfo bufferCI{};
         bufferCI.size = aStructSizesBI.accelerationStructureSize;
@@ -36,12 +45,15 @@ namespace hd {
 
         _aStruct = _device.createAccelerationStructureKHR(aStructCI, nullptr);
 
-        // Scratch
+        // Updatable structures are refitted from the frame command buffers, never on the host
+        const bool onHost = (ci.batch == nullptr) && !_updatable && ci.device->_aStructFeatures.accelerationStructureHostCommands;
+
+        // Scratch, only host builds need it visible to the host
         vk::BufferCreateInfo scratchCI{};
-        scratchCI.size = aStructSizesBI.buildScratchSize;
+        scratchCI.size = std::max(aStructSizesBI.buildScratchSize, aStructSizesBI.updateScratchSize);
         scratchCI.usage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress;
 
-        auto scratch = _allocator->create(scratchCI, VMA_MEMORY_USAGE_CPU_TO_GPU);
+        auto scratch = _allocator->create(scratchCI, onHost ? VMA_MEMORY_USAGE_CPU_TO_GPU : VMA_MEMORY_USAGE_GPU_ONLY);
 
         vk::BufferDeviceAddressInfo scratchAI{};
         scratchAI.buffer = scratch.buffer;
@@ -50,19 +62,22 @@ namespace hd {
 
         vk::AccelerationStructureBuildGeometryInfoKHR aStructGeometryBI2{};
         aStructGeometryBI2.type = vk::AccelerationStructureTypeKHR::eTopLevel;
-        aStructGeometryBI2.flags = vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace;
+        aStructGeometryBI2.flags = _flags;
         aStructGeometryBI2.mode = vk::BuildAccelerationStructureModeKHR::eBuild;
         aStructGeometryBI2.dstAccelerationStructure = _aStruct;
-        aStructGeometryBI2.setGeometries(aStructGeometry);
+        aStructGeometryBI2.setGeometries(_geometry);
         aStructGeometryBI2.scratchData.deviceAddress = scratchAdress;
 
         vk::AccelerationStructureBuildRangeInfoKHR aStructRangeBI{};
-        aStructRangeBI.primitiveCount = ci.instbuffer->count();
+        aStructRangeBI.primitiveCount = _count;
         aStructRangeBI.primitiveOffset = 0;
         aStructRangeBI.firstVertex = 0;
         aStructRangeBI.transformOffset = 0;
 
-        if (ci.device->_aStructFeatures.accelerationStructureHostCommands) {
+        if (ci.batch != nullptr) {
+            // Inputs are only resident once the batch completes, so the build has to go through it too
+            ci.batch->commandBuffer()->raw().buildAccelerationStructuresKHR(aStructGeometryBI2, &aStructRangeBI);
+        } else if (onHost) {
             // Implementation supports building acceleration structure building on host
             if (_device.buildAccelerationStructuresKHR(nullptr, aStructGeometryBI2, &aStructRangeBI) != vk::Result::eSuccess)
                 throw std::runtime_error("Unable to create TLAS");
@@ -79,10 +94,52 @@ namespace hd {
         _aAddress = _device.getAccelerationStructureAddressKHR(aDeviceAddressInfo);
 
         // Cleanup
-        _allocator->destroy(scratch.buffer, scratch.allocation);
+        if (_updatable) {
+            _scratch = scratch;
+            _scratchAddress = scratchAdress;
+        } else if (ci.batch != nullptr) {
+            auto allocator = _allocator;
+            ci.batch->onComplete([allocator, scratch]() {
+                allocator->destroy(scratch.buffer, scratch.allocation);
+            });
+        } else {
+            _allocator->destroy(scratch.buffer, scratch.allocation);
+        }
+    }
+
+    void TLAS_t::update(CommandBuffer cmd, vk::DeviceAddress instances, uint32_t count, bool rebuild) {
+        if (!_updatable)
+            throw std::runtime_error("TLAS was not created with allowUpdate");
+
+        if (count > _capacity)
+            throw std::runtime_error("TLAS update has more instances than maxInstances");
+
+        // Refits keep the instance count of the structure they start from
+        rebuild = rebuild || (count != _count);
+
+        _geometry.geometry.instances.data.deviceAddress = instances;
+
+        vk::AccelerationStructureBuildGeometryInfoKHR aStructGeometryBI{};
+        aStructGeometryBI.type = vk::AccelerationStructureTypeKHR::eTopLevel;
+        aStructGeometryBI.flags = _flags;
+        aStructGeometryBI.mode = rebuild ? vk::BuildAccelerationStructureModeKHR::eBuild : vk::BuildAccelerationStructureModeKHR::eUpdate;
+        aStructGeometryBI.srcAccelerationStructure = rebuild ? nullptr : _aStruct;
+        aStructGeometryBI.dstAccelerationStructure = _aStruct;
+        aStructGeometryBI.setGeometries(_geometry);
+        aStructGeometryBI.scratchData.deviceAddress = _scratchAddress;
+
+        vk::AccelerationStructureBuildRangeInfoKHR aStructRangeBI{};
+        aStructRangeBI.primitiveCount = count;
+
+        cmd->raw().buildAccelerationStructuresKHR(aStructGeometryBI, &aStructRangeBI);
+
+        _count = count;
     }
 
     TLAS_t::~TLAS_t() {
+        if (_updatable)
+            _allocator->destroy(_scratch.buffer, _scratch.allocation);
+
         _device.destroyAccelerationStructureKHR(_aStruct);
         _allocator->destroy(memory.buffer, memory.allocation);
     }
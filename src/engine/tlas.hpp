@@ -18,6 +18,9 @@ namespace hd {
         Queue queue;
         Device device;
         Allocator allocator;
+        UploadBatch batch = nullptr; // Inputs must be made visible with batch->barrier() first
+        bool allowUpdate = false; // Keeps the scratch around for update()
+        uint32_t maxInstances = 0; // Rebuilds can grow up to it, instbuffer->count() when 0
     };
 
     class TLAS_t;
@@ -31,6 +34,15 @@ namespace hd {
             vk::DeviceAddress _aAddress;
             ReturnBuffer memory;
 
+            vk::AccelerationStructureGeometryKHR _geometry;
+            vk::BuildAccelerationStructureFlagsKHR _flags;
+            uint32_t _count;
+            uint32_t _capacity;
+
+            bool _updatable;
+            ReturnBuffer _scratch{};
+            vk::DeviceAddress _scratchAddress = 0;
+
         public:
             static TLAS conjure(TLASCreateInfo const & ci) {
                 return std::make_shared<TLAS_t>(ci);
@@ -46,6 +58,14 @@ namespace hd {
                 return _aAddress;
             }
 
+            inline auto count() {
+                return _count;
+            }
+
+            // Records a refit over the same instances with new transforms, or a full build when
+            // rebuild is set or count changed. Needs allowUpdate, count can't exceed maxInstances.
+            void update(CommandBuffer cmd, vk::DeviceAddress instances, uint32_t count, bool rebuild = false);
+
             auto writeInfo(){
                 vk::WriteDescriptorSetAccelerationStructureKHR info{};
                 info.setAccelerationStructures(_aStruct);
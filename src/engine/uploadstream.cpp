@@ -0,0 +1,169 @@
+#include <uploadstream.hpp>
+
+namespace hd {
+    static constexpr vk::PipelineStageFlags uploadWaitStages = vk::PipelineStageFlagBits::eRayTracingShaderKHR
+        | vk::PipelineStageFlagBits::eComputeShader
+        | vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR
+        | vk::PipelineStageFlagBits::eTransfer;
+
+    UploadStream_t::UploadStream_t(UploadStreamCreateInfo const & ci) {
+        _device = ci.device;
+        _allocator = ci.allocator;
+        _arenaSize = ci.arenaSize;
+
+        _transferQueue = hd::conjure({
+                .device = _device,
+                .type = QueueType::eTransfer,
+                });
+
+        _transferPool = hd::conjure({
+                .device = _device,
+                .family = PoolFamily::eTransfer,
+                });
+
+        _graphicsPool = hd::conjure({
+                .device = _device,
+                .family = PoolFamily::eGraphics,
+                });
+
+        _transferFamily = _device->indices().transferFamily.value();
+        _graphicsFamily = _device->indices().graphicsFamily.value();
+        _shared = (_transferQueue->raw() == ci.graphicsQueue->raw());
+
+        _worker = std::thread(&UploadStream_t::work, this);
+    }
+
+    std::future<void> UploadStream_t::enqueue(std::function<void(UploadBatch)> record, std::function<void()> ready) {
+        auto recorded = std::make_shared<std::promise<void>>();
+        auto future = recorded->get_future();
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _jobs.push_back({ std::move(record), std::move(ready), recorded });
+        }
+        _condition.notify_one();
+
+        return future;
+    }
+
+    void UploadStream_t::work() {
+        while (true) {
+            Job job;
+            std::vector<UploadBatch> finished;
+
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _condition.wait(lock, [this]() { return _stop || !_jobs.empty(); });
+
+                finished.swap(_finished);
+
+                if (_stop && _jobs.empty())
+                    return;
+
+                job = std::move(_jobs.front());
+                _jobs.pop_front();
+            }
+
+            finished.clear();
+
+            auto batch = UploadBatch_t::conjure({
+                    .commandPool = _transferPool,
+                    .queue = _transferQueue,
+                    .allocator = _allocator,
+                    .device = _device,
+                    .arenaSize = _arenaSize,
+                    .srcFamily = _transferFamily,
+                    .dstFamily = _graphicsFamily,
+                    });
+
+            try {
+                job.record(batch);
+            } catch (...) {
+                job.recorded->set_exception(std::current_exception());
+                continue;
+            }
+
+            Upload upload{ batch, Semaphore_t::conjure({ .device = _device }), std::move(job.ready), false };
+
+            batch->end();
+            if (!_shared) {
+                batch->submit(upload.semaphore);
+                upload.submitted = true;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _uploads.push_back(std::move(upload));
+            }
+
+            job.recorded->set_value();
+        }
+    }
+
+    void UploadStream_t::retire() {
+        // Submits complete in order, so do the fences guarding them
+        while (!_acquired.empty() && _acquired.front().fence->signaled()) {
+            auto& acquired = _acquired.front();
+
+            for (auto& upload : acquired.uploads) {
+                upload.batch->wait();
+
+                if (upload.ready)
+                    upload.ready();
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                for (auto& upload : acquired.uploads)
+                    _finished.push_back(std::move(upload.batch));
+            }
+
+            _acquired.pop_front();
+        }
+    }
+
+    void UploadStream_t::acquire(UploadAcquire& acquire, Fence fence) {
+        retire();
+
+        std::vector<Upload> uploads;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            uploads.swap(_uploads);
+        }
+
+        if (uploads.empty())
+            return;
+
+        auto cmd = _graphicsPool->singleTimeBegin();
+
+        for (auto& upload : uploads) {
+            if (!upload.submitted) {
+                upload.batch->submit(upload.semaphore);
+                upload.submitted = true;
+            }
+
+            upload.batch->acquire(cmd);
+
+            acquire.semaphores.push_back(upload.semaphore->raw());
+            acquire.stages.push_back(uploadWaitStages);
+        }
+
+        cmd->end();
+        acquire.commandBuffer = cmd;
+
+        _acquired.push_back({ std::move(uploads), cmd, fence });
+    }
+
+    UploadStream_t::~UploadStream_t() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _condition.notify_all();
+
+        _worker.join();
+
+        // Nothing recorded here may be freed while the device still uses it
+        _device->waitIdle();
+    }
+}
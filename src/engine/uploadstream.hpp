@@ -0,0 +1,109 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <hdvw/device.hpp>
+#include <hdvw/allocator.hpp>
+#include <hdvw/commandpool.hpp>
+#include <hdvw/commandbuffer.hpp>
+#include <hdvw/queue.hpp>
+#include <hdvw/fence.hpp>
+#include <hdvw/semaphore.hpp>
+#include <hdvw/uploadbatch.hpp>
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <deque>
+#include <vector>
+#include <memory>
+
+namespace hd {
+    struct UploadStreamCreateInfo {
+        Device device;
+        Allocator allocator;
+        Queue graphicsQueue; // Only used to tell whether the transfer queue is the same queue
+        vk::DeviceSize arenaSize = 64ull << 20;
+    };
+
+    // What the next graphics submit has to wait on and execute before its own command buffers
+    struct UploadAcquire {
+        std::vector<vk::Semaphore> semaphores;
+        std::vector<vk::PipelineStageFlags> stages;
+        CommandBuffer commandBuffer = nullptr;
+    };
+
+    class UploadStream_t;
+    typedef std::shared_ptr<UploadStream_t> UploadStream;
+
+    // Records uploads on a background thread and submits them to the transfer queue.
+    // The graphics queue picks them up through acquire(), frames keep rendering meanwhile.
+    class UploadStream_t {
+        private:
+            struct Job {
+                std::function<void(UploadBatch)> record;
+                std::function<void()> ready;
+                std::shared_ptr<std::promise<void>> recorded;
+            };
+
+            struct Upload {
+                UploadBatch batch;
+                Semaphore semaphore;
+                std::function<void()> ready;
+                bool submitted;
+            };
+
+            struct Acquired {
+                std::vector<Upload> uploads;
+                CommandBuffer commandBuffer;
+                Fence fence;
+            };
+
+            Device _device;
+            Allocator _allocator;
+            vk::DeviceSize _arenaSize;
+
+            Queue _transferQueue;
+            CommandPool _transferPool;
+            CommandPool _graphicsPool;
+            uint32_t _transferFamily;
+            uint32_t _graphicsFamily;
+            bool _shared; // The transfer queue is the graphics queue, it is only submitted to from acquire()
+
+            std::thread _worker;
+            std::mutex _mutex;
+            std::condition_variable _condition;
+            bool _stop = false;
+
+            std::deque<Job> _jobs;
+            std::vector<Upload> _uploads;
+            std::deque<Acquired> _acquired;
+            std::vector<UploadBatch> _finished; // Destroyed on the worker, it owns the transfer pool
+
+            void work();
+
+            void retire();
+
+        public:
+            static UploadStream conjure(UploadStreamCreateInfo const & ci) {
+                return std::make_shared<UploadStream_t>(ci);
+            }
+
+            UploadStream_t(UploadStreamCreateInfo const & ci);
+
+            // record runs on the stream thread, the future is ready once it has returned.
+            // ready runs inside a later acquire(), after the first submit using the upload has completed.
+            std::future<void> enqueue(std::function<void(UploadBatch)> record, std::function<void()> ready = nullptr);
+
+            // Call between waiting on fence and resetting it for the next submit, which has to use acquire
+            void acquire(UploadAcquire& acquire, Fence fence);
+
+            ~UploadStream_t();
+    };
+
+    inline UploadStream conjure(UploadStreamCreateInfo const & ci) {
+        return UploadStream_t::conjure(ci);
+    }
+}
@@ -201,6 +201,11 @@ void CommandBuffer_t::copy(CopyBufferToBufferInfo ci) {
 }
 
 void CommandBuffer_t::copy(CopyBufferToImageInfo ci) {
+    if (!ci.regions.empty()) {
+        _buffer.copyBufferToImage(ci.buffer->raw(), ci.image->raw(), ci.image->layout(), ci.regions);
+        return;
+    }
+
     vk::BufferImageCopy region = {};
     region.bufferOffset = 0;
     region.bufferRowLength = 0;
@@ -8,6 +8,7 @@
 #include <hdvw/image.hpp>
 
 #include <memory>
+#include <vector>
 
 namespace hd {
     struct CommandBufferCreateInfo {
@@ -56,6 +57,7 @@ namespace hd {
     struct CopyBufferToImageInfo {
         Buffer buffer;
         Image image;
+        std::vector<vk::BufferImageCopy> regions = {}; // Whole first level when empty
     };
 
     class CommandBuffer_t {
@@ -7,8 +7,10 @@
 #include <hdvw/queue.hpp>
 #include <hdvw/buffer.hpp>
 #include <hdvw/device.hpp>
+#include <hdvw/uploadbatch.hpp>
 
 #include <memory>
+#include <span>
 
 namespace hd {
     template<class Data>
@@ -17,9 +19,10 @@ namespace hd {
         Queue queue;
         Allocator allocator;
         Device device;
-        std::vector<Data> data;
+        std::span<const Data> data; // Staged right away, only has to outlive the constructor
         vk::BufferUsageFlags usage;
         VmaMemoryUsage memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY;
+        UploadBatch batch = nullptr; // Records the copy there instead of waiting on it
     };
 
     template<class Data>
@@ -46,18 +49,6 @@ namespace hd {
                 _entities = ci.data.size();
                 uint64_t _size = sizeof(ci.data[0]) * ci.data.size();
 
-                Buffer stagingBuffer = hd::conjure({
-                        .allocator = ci.allocator,
-                        .size = _size,
-                        .bufferUsage = vk::BufferUsageFlagBits::eTransferSrc,
-                        .memoryUsage = VMA_MEMORY_USAGE_CPU_ONLY,
-                        });
-
-                void* data = nullptr;
-                ci.allocator->map(stagingBuffer->memory(), data);
-                memcpy(data, ci.data.data(), (size_t) _size);
-                ci.allocator->unmap(stagingBuffer->memory());
-
                 _buffer = hd::conjure({
                         .allocator = ci.allocator,
                         .size = _size,
@@ -65,12 +56,36 @@ namespace hd {
                         .memoryUsage = ci.memoryUsage,
                         });
 
-                CommandBuffer cmd = ci.commandPool->singleTimeBegin();
-                cmd->copy({
-                        .srcBuffer = stagingBuffer,
-                        .dstBuffer = _buffer,
-                        });
-                ci.commandPool->singleTimeEnd(cmd, ci.queue);
+                if (ci.batch != nullptr) {
+                    auto staged = ci.batch->stage(ci.data.data(), _size);
+
+                    ci.batch->commandBuffer()->copy({
+                            .srcBuffer = staged.buffer,
+                            .dstBuffer = _buffer,
+                            .srcOffset = staged.offset,
+                            .size = _size,
+                            });
+                    ci.batch->release(_buffer);
+                } else {
+                    Buffer stagingBuffer = hd::conjure({
+                            .allocator = ci.allocator,
+                            .size = _size,
+                            .bufferUsage = vk::BufferUsageFlagBits::eTransferSrc,
+                            .memoryUsage = VMA_MEMORY_USAGE_CPU_ONLY,
+                            });
+
+                    void* data = nullptr;
+                    ci.allocator->map(stagingBuffer->memory(), data);
+                    memcpy(data, ci.data.data(), (size_t) _size);
+                    ci.allocator->unmap(stagingBuffer->memory());
+
+                    CommandBuffer cmd = ci.commandPool->singleTimeBegin();
+                    cmd->copy({
+                            .srcBuffer = stagingBuffer,
+                            .dstBuffer = _buffer,
+                            });
+                    ci.commandPool->singleTimeEnd(cmd, ci.queue);
+                }
 
                 vk::BufferDeviceAddressInfo bufferDeviceAI{};
                 bufferDeviceAI.buffer = _buffer->raw();
@@ -48,6 +48,16 @@ QueueFamilyIndices Device_t::findQueueFamilies(vk::PhysicalDevice physicalDevice
         }
     }
 
+    // A transfer only family runs on the copy engines, beside rendering
+    for (uint32_t iter = 0; iter < queueFamilies.size(); iter++) {
+        auto flags = queueFamilies[iter].queueFlags;
+        if ((flags & vk::QueueFlagBits::eTransfer) && !(flags & (vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute))) {
+            indices.transferFamily = iter;
+            indices.transferCount = queueFamilies[iter].queueCount;
+            break;
+        }
+    }
+
     return indices;
 }
 
@@ -153,10 +163,14 @@ Device_t::Device_t(DeviceCreateInfo const & ci) {
         queueCreateInfos.push_back(queueCreateInfo);
     }
 
+    // BC compression is optional, textures fall back to RGBA8 on devices without it
+    vk::PhysicalDeviceFeatures2 features = ci.features;
+    features.features.textureCompressionBC = ci.features.features.textureCompressionBC && _physicalDevice.getFeatures().textureCompressionBC;
+
     vk::DeviceCreateInfo createInfo = {};
     createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
     createInfo.pQueueCreateInfos = queueCreateInfos.data();
-    createInfo.pNext = &ci.features;
+    createInfo.pNext = &features;
     createInfo.enabledExtensionCount = static_cast<uint32_t>(ci.extensions.size());
     createInfo.ppEnabledExtensionNames = ci.extensions.data();
 
@@ -20,6 +20,10 @@ void Fence_t::reset() {
     _device.resetFences(_fence);
 }
 
+bool Fence_t::signaled() {
+    return _device.getFenceStatus(_fence) == vk::Result::eSuccess;
+}
+
 Fence_t::~Fence_t() {
     _device.destroy(_fence);
 }
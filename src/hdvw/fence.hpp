@@ -36,6 +36,8 @@ namespace hd {
 
             void reset();
 
+            bool signaled();
+
             inline auto raw() {
                 return _fence;
             }
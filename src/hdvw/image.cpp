@@ -10,14 +10,14 @@ Image_t::Image_t(ImageCreateInfo const & ci) {
     _range.baseArrayLayer = 0;
     _range.baseMipLevel = 0;
     _range.layerCount = ci.layers;
-    _range.levelCount = 1;
+    _range.levelCount = ci.mipLevels;
 
     vk::ImageCreateInfo ici = {};
     ici.imageType = vk::ImageType::e2D;
     ici.extent.width = ci.extent.width;
     ici.extent.height = ci.extent.height;
     ici.extent.depth = 1;
-    ici.mipLevels = 1;
+    ici.mipLevels = ci.mipLevels;
     ici.arrayLayers = _range.layerCount;
     ici.format = _format;
     ici.tiling = ci.tiling;
@@ -72,6 +72,8 @@ Sampler_t::Sampler_t(SamplerCreateInfo const & ci) {
     si.compareEnable = VK_FALSE;
     si.compareOp = vk::CompareOp::eAlways;
     si.mipmapMode = vk::SamplerMipmapMode::eLinear;
+    si.minLod = 0.0f;
+    si.maxLod = ci.maxLod;
 
     _sampler = _device.createSampler(si);
 }
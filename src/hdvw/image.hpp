@@ -14,6 +14,7 @@ namespace hd {
         vk::Format format = vk::Format::eR8G8B8A8Srgb;
         vk::ImageAspectFlags aspect = vk::ImageAspectFlagBits::eColor;
         uint32_t layers = 1;
+        uint32_t mipLevels = 1;
         vk::ImageCreateFlags flags = vk::ImageCreateFlags{0};
         vk::ImageTiling tiling = vk::ImageTiling::eOptimal;
         vk::ImageUsageFlags imageUsage = vk::ImageUsageFlagBits::eSampled;
@@ -119,6 +120,7 @@ namespace hd {
     struct SamplerCreateInfo {
         Device device;
         vk::SamplerAddressMode addressMode = vk::SamplerAddressMode::eRepeat;
+        float maxLod = 0.0f;
     };
 
     class Sampler_t;
@@ -1,51 +1,93 @@
 #include <hdvw/texture.hpp>
 using namespace hd;
 
-Texture_t::Texture_t(TextureCreateInfo const & ci) {
+TexturePixels Texture_t::decode(const char* filename) {
     int texWidth, texHeight, texChannels;
-    stbi_uc* pixels = stbi_load(ci.filename, &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-    VkDeviceSize imageSize = texWidth * texHeight * 4;
+    stbi_uc* pixels = stbi_load(filename, &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
 
     if (!pixels) {
-        throw std::runtime_error("failed to load texture image!");
+        throw std::runtime_error(std::string("failed to load texture image ") + filename);
     }
 
-    Buffer stagingBuffer = Buffer_t::conjure({
-            .allocator = ci.allocator,
-            .size = imageSize,
-            .bufferUsage = vk::BufferUsageFlagBits::eTransferSrc,
-            .memoryUsage = VMA_MEMORY_USAGE_CPU_ONLY,
-            });
-
-    void* data;
-    ci.allocator->map(stagingBuffer->memory(), data);
-    memcpy(data, pixels, static_cast<size_t>(imageSize));
-    ci.allocator->unmap(stagingBuffer->memory());
+    TexturePixels ret;
+    ret.width = texWidth;
+    ret.height = texHeight;
+    ret.data.assign(pixels, pixels + texWidth * texHeight * 4);
 
     stbi_image_free(pixels);
 
+    return ret;
+}
+
+Texture_t::Texture_t(TextureCreateInfo const & ci) {
+    TexturePixels decoded;
+    if (ci.pixels == nullptr)
+        decoded = decode(ci.filename);
+
+    auto const & pixels = (ci.pixels != nullptr) ? *ci.pixels : decoded;
+    VkDeviceSize imageSize = pixels.data.size();
+
+    auto levels = pixels.levels;
+    if (levels.empty())
+        levels.push_back({ .offset = 0, .width = pixels.width, .height = pixels.height });
+
+    // Cooked levels are 16 byte aligned relative to the data, keep them aligned inside the arena for block formats
+    StagingRegion staging;
+    if (ci.batch != nullptr) {
+        staging = ci.batch->stage(pixels.data.data(), imageSize, 16);
+    } else {
+        staging.buffer = Buffer_t::conjure({
+                .allocator = ci.allocator,
+                .size = imageSize,
+                .bufferUsage = vk::BufferUsageFlagBits::eTransferSrc,
+                .memoryUsage = VMA_MEMORY_USAGE_CPU_ONLY,
+                });
+        staging.offset = 0;
+
+        void* data;
+        ci.allocator->map(staging.buffer->memory(), data);
+        memcpy(data, pixels.data.data(), static_cast<size_t>(imageSize));
+        ci.allocator->unmap(staging.buffer->memory());
+    }
+
     _image = hd::conjure({
             .allocator = ci.allocator,
-            .extent = {(uint32_t) texWidth, (uint32_t) texHeight},
-            .format = vk::Format::eR8G8B8A8Srgb,
+            .extent = {pixels.width, pixels.height},
+            .format = pixels.format,
+            .mipLevels = static_cast<uint32_t>(levels.size()),
             .imageUsage = vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled,
             .memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY,
             });
 
-    auto buff = ci.commandPool->singleTimeBegin();
+    auto buff = (ci.batch != nullptr) ? ci.batch->commandBuffer() : ci.commandPool->singleTimeBegin();
     buff->transitionImageLayout({
             .image = _image,
             .layout = vk::ImageLayout::eTransferDstOptimal,
             });
+    std::vector<vk::BufferImageCopy> regions(levels.size());
+    for (uint32_t iter = 0; iter < levels.size(); iter++) {
+        regions[iter].bufferOffset = staging.offset + levels[iter].offset;
+        regions[iter].imageSubresource.aspectMask = _image->range().aspectMask;
+        regions[iter].imageSubresource.mipLevel = iter;
+        regions[iter].imageSubresource.baseArrayLayer = 0;
+        regions[iter].imageSubresource.layerCount = _image->range().layerCount;
+        regions[iter].imageExtent = vk::Extent3D{levels[iter].width, levels[iter].height, 1};
+    }
+
     buff->copy({
-            .buffer = stagingBuffer,
+            .buffer = staging.buffer,
             .image = _image,
+            .regions = regions,
             });
-    buff->transitionImageLayout({
-            .image = _image,
-            .layout = vk::ImageLayout::eShaderReadOnlyOptimal,
-            });
-    ci.commandPool->singleTimeEnd(buff, ci.queue);
+    if (ci.batch != nullptr) {
+        ci.batch->release(_image, vk::ImageLayout::eShaderReadOnlyOptimal);
+    } else {
+        buff->transitionImageLayout({
+                .image = _image,
+                .layout = vk::ImageLayout::eShaderReadOnlyOptimal,
+                });
+        ci.commandPool->singleTimeEnd(buff, ci.queue);
+    }
 
     _imageView = hd::conjure({
             .image = _image->raw(),
@@ -58,5 +100,6 @@ Texture_t::Texture_t(TextureCreateInfo const & ci) {
     _sampler = hd::conjure({
             .device = ci.device,
             .addressMode = vk::SamplerAddressMode::eRepeat,
+            .maxLod = static_cast<float>(levels.size() - 1),
             });
 }
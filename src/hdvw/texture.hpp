@@ -9,16 +9,35 @@
 #include <hdvw/allocator.hpp>
 #include <hdvw/image.hpp>
 #include <hdvw/buffer.hpp>
+#include <hdvw/uploadbatch.hpp>
 
 #include <memory>
+#include <vector>
 
 namespace hd {
+    struct TextureLevel {
+        uint64_t offset;
+        uint32_t width;
+        uint32_t height;
+    };
+
+    // Texel data ready for a straight staging copy, safe to produce off the render thread
+    struct TexturePixels {
+        uint32_t width = 0;
+        uint32_t height = 0;
+        vk::Format format = vk::Format::eR8G8B8A8Srgb;
+        std::vector<TextureLevel> levels; // A single level at offset 0 when empty
+        std::vector<stbi_uc> data;
+    };
+
     struct TextureCreateInfo {
         const char* filename;
         CommandPool commandPool;
         Queue queue;
         Allocator allocator;
         Device device;
+        TexturePixels const * pixels = nullptr; // Used instead of decoding filename
+        UploadBatch batch = nullptr; // Records the upload there instead of waiting on it
     };
 
     class Texture_t;
@@ -35,6 +54,8 @@ namespace hd {
                 return std::make_shared<Texture_t>(ci);
             }
 
+            static TexturePixels decode(const char* filename);
+
             Texture_t(TextureCreateInfo const & ci);
 
             vk::DescriptorImageInfo writeInfo(vk::ImageLayout layout) {
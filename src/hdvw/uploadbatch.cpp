@@ -0,0 +1,192 @@
+#include <hdvw/uploadbatch.hpp>
+using namespace hd;
+
+UploadBatch_t::UploadBatch_t(UploadBatchCreateInfo const & ci) {
+    _commandPool = ci.commandPool;
+    _queue = ci.queue;
+    _allocator = ci.allocator;
+    _arenaSize = ci.arenaSize;
+
+    if (ci.srcFamily == VK_QUEUE_FAMILY_IGNORED || ci.dstFamily == VK_QUEUE_FAMILY_IGNORED) {
+        _srcFamily = VK_QUEUE_FAMILY_IGNORED;
+        _dstFamily = VK_QUEUE_FAMILY_IGNORED;
+    } else {
+        _srcFamily = ci.srcFamily;
+        _dstFamily = ci.dstFamily;
+    }
+
+    _fence = Fence_t::conjure({
+            .device = ci.device,
+            .state = FenceState::eIdle,
+            });
+
+    _cmd = _commandPool->singleTimeBegin();
+}
+
+StagingRegion UploadBatch_t::stage(const void* data, vk::DeviceSize size, vk::DeviceSize alignment) {
+    if (_ended)
+        throw std::runtime_error("Upload batch was already ended");
+
+    vk::DeviceSize offset = (_offset + alignment - 1) / alignment * alignment;
+
+    if (_arenas.empty() || offset + size > _arenas.back()->size()) {
+        if (_mapped != nullptr)
+            _arenas.back()->unmap();
+
+        _arenas.push_back(hd::conjure({
+                .allocator = _allocator,
+                .size = std::max(_arenaSize, size),
+                .bufferUsage = vk::BufferUsageFlagBits::eTransferSrc,
+                .memoryUsage = VMA_MEMORY_USAGE_CPU_ONLY,
+                }));
+
+        _mapped = static_cast<uint8_t*>(_arenas.back()->map());
+        offset = 0;
+    }
+
+    memcpy(_mapped + offset, data, size);
+    _offset = offset + size;
+
+    return { _arenas.back(), offset };
+}
+
+void UploadBatch_t::barrier() {
+    vk::MemoryBarrier memoryBarrier{};
+    memoryBarrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite | vk::AccessFlagBits::eAccelerationStructureWriteKHR;
+    memoryBarrier.dstAccessMask = vk::AccessFlagBits::eAccelerationStructureReadKHR | vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eTransferRead;
+
+    _cmd->raw().pipelineBarrier(
+            vk::PipelineStageFlagBits::eTransfer | vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+            vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR | vk::PipelineStageFlagBits::eRayTracingShaderKHR | vk::PipelineStageFlagBits::eTransfer,
+            vk::DependencyFlags{0}, memoryBarrier, nullptr, nullptr);
+}
+
+void UploadBatch_t::hold(std::shared_ptr<void> resource) {
+    _held.push_back(std::move(resource));
+}
+
+void UploadBatch_t::release(Buffer buffer) {
+    if (transfersOwnership()) {
+        vk::BufferMemoryBarrier barrier{};
+        barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+        barrier.srcQueueFamilyIndex = _srcFamily;
+        barrier.dstQueueFamilyIndex = _dstFamily;
+        barrier.buffer = buffer->raw();
+        barrier.offset = 0;
+        barrier.size = VK_WHOLE_SIZE;
+
+        _cmd->raw().pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe,
+                vk::DependencyFlags{0}, nullptr, barrier, nullptr);
+
+        barrier.srcAccessMask = vk::AccessFlags{0};
+        barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eTransferRead;
+        _bufferAcquires.push_back(barrier);
+    }
+
+    hold(buffer);
+}
+
+void UploadBatch_t::release(Image image, vk::ImageLayout layout) {
+    if (transfersOwnership()) {
+        vk::ImageMemoryBarrier barrier{};
+        barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+        barrier.oldLayout = image->layout();
+        barrier.newLayout = layout;
+        barrier.srcQueueFamilyIndex = _srcFamily;
+        barrier.dstQueueFamilyIndex = _dstFamily;
+        barrier.image = image->raw();
+        barrier.subresourceRange = image->range();
+
+        _cmd->raw().pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe,
+                vk::DependencyFlags{0}, nullptr, nullptr, barrier);
+
+        barrier.srcAccessMask = vk::AccessFlags{0};
+        barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+        _imageAcquires.push_back(barrier);
+
+        image->setLayout(layout);
+    } else {
+        _cmd->transitionImageLayout({
+                .image = image,
+                .layout = layout,
+                });
+    }
+
+    hold(image);
+}
+
+void UploadBatch_t::acquire(CommandBuffer cmd) {
+    if (_bufferAcquires.empty() && _imageAcquires.empty())
+        return;
+
+    cmd->raw().pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe,
+            vk::PipelineStageFlagBits::eRayTracingShaderKHR | vk::PipelineStageFlagBits::eComputeShader
+            | vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR | vk::PipelineStageFlagBits::eTransfer,
+            vk::DependencyFlags{0}, nullptr, _bufferAcquires, _imageAcquires);
+}
+
+void UploadBatch_t::onComplete(std::function<void()> f) {
+    _completions.push_back(std::move(f));
+}
+
+void UploadBatch_t::end() {
+    if (_ended)
+        return;
+
+    if (_mapped != nullptr) {
+        _arenas.back()->unmap();
+        _mapped = nullptr;
+    }
+
+    _cmd->end();
+    _ended = true;
+}
+
+void UploadBatch_t::submit(Semaphore signal) {
+    if (_submitted)
+        return;
+
+    end();
+
+    auto raw = _cmd->raw();
+    vk::SubmitInfo si = {};
+    si.commandBufferCount = 1;
+    si.pCommandBuffers = &raw;
+
+    vk::Semaphore semaphore;
+    if (signal != nullptr) {
+        semaphore = signal->raw();
+        si.signalSemaphoreCount = 1;
+        si.pSignalSemaphores = &semaphore;
+    }
+
+    _queue->submit(si, _fence);
+
+    _submitted = true;
+}
+
+void UploadBatch_t::wait() {
+    if (!_submitted)
+        return;
+
+    _fence->wait();
+
+    for (auto& f : _completions)
+        f();
+
+    _completions.clear();
+    _held.clear();
+    _arenas.clear();
+}
+
+UploadBatch_t::~UploadBatch_t() {
+    // Never free resources the device may still be reading
+    if (_mapped != nullptr)
+        _arenas.back()->unmap();
+
+    if (_submitted)
+        wait();
+    else
+        for (auto& f : _completions)
+            f();
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <hdvw/allocator.hpp>
+#include <hdvw/commandpool.hpp>
+#include <hdvw/commandbuffer.hpp>
+#include <hdvw/queue.hpp>
+#include <hdvw/buffer.hpp>
+#include <hdvw/image.hpp>
+#include <hdvw/fence.hpp>
+#include <hdvw/semaphore.hpp>
+#include <hdvw/device.hpp>
+
+#include <memory>
+#include <vector>
+#include <functional>
+
+namespace hd {
+    struct UploadBatchCreateInfo {
+        CommandPool commandPool;
+        Queue queue;
+        Allocator allocator;
+        Device device;
+        vk::DeviceSize arenaSize = 64ull << 20;
+        // Families of the recording queue and of the queue that uses the results, ownership is transferred when they differ
+        uint32_t srcFamily = VK_QUEUE_FAMILY_IGNORED;
+        uint32_t dstFamily = VK_QUEUE_FAMILY_IGNORED;
+    };
+
+    struct StagingRegion {
+        Buffer buffer;
+        vk::DeviceSize offset;
+    };
+
+    class UploadBatch_t;
+    typedef std::shared_ptr<UploadBatch_t> UploadBatch;
+
+    // Collects uploads and builds into one command buffer backed by a shared staging arena.
+    // Nothing recorded here may be used before wait() returns.
+    class UploadBatch_t {
+        private:
+            CommandPool _commandPool;
+            Queue _queue;
+            Allocator _allocator;
+            vk::DeviceSize _arenaSize;
+            uint32_t _srcFamily;
+            uint32_t _dstFamily;
+
+            CommandBuffer _cmd;
+            Fence _fence;
+            bool _ended = false;
+            bool _submitted = false;
+
+            std::vector<Buffer> _arenas;
+            uint8_t* _mapped = nullptr;
+            vk::DeviceSize _offset = 0;
+
+            std::vector<std::shared_ptr<void>> _held;
+            std::vector<std::function<void()>> _completions;
+
+            std::vector<vk::BufferMemoryBarrier> _bufferAcquires;
+            std::vector<vk::ImageMemoryBarrier> _imageAcquires;
+
+        public:
+            static UploadBatch conjure(UploadBatchCreateInfo const & ci) {
+                return std::make_shared<UploadBatch_t>(ci);
+            }
+
+            UploadBatch_t(UploadBatchCreateInfo const & ci);
+
+            // Copies size bytes into the arena, the region stays valid until wait()
+            StagingRegion stage(const void* data, vk::DeviceSize size, vk::DeviceSize alignment = 16);
+
+            inline auto commandBuffer() {
+                return _cmd;
+            }
+
+            // Makes every transfer and acceleration structure write recorded so far visible to later builds and shaders
+            void barrier();
+
+            // Keeps resource alive until wait()
+            void hold(std::shared_ptr<void> resource);
+
+            // Holds a written resource and hands it over to the destination family, images end up in layout
+            void release(Buffer buffer);
+
+            void release(Image image, vk::ImageLayout layout);
+
+            // Records the destination side of every release into cmd, which has to wait on the submit's semaphore
+            void acquire(CommandBuffer cmd);
+
+            inline auto transfersOwnership() {
+                return _srcFamily != _dstFamily;
+            }
+
+            // Runs f after wait(), for cleanups that can't be expressed as a held resource
+            void onComplete(std::function<void()> f);
+
+            // Stops recording, lets another thread submit the batch while this pool records again
+            void end();
+
+            void submit(Semaphore signal = nullptr);
+
+            void wait();
+
+            inline void flush() {
+                submit();
+                wait();
+            }
+
+            ~UploadBatch_t();
+    };
+
+    inline UploadBatch conjure(UploadBatchCreateInfo const & ci) {
+        return UploadBatch_t::conjure(ci);
+    }
+}
@@ -65,6 +65,40 @@ namespace hd {
                 && bitangent == other.bitangent;
         }
     };
+
+    // Shading attributes as fetched by the closest hit shaders, positions live in their own stream.
+    // Normal and tangent are octahedral snorm16x2, texCoord is half2. A tangent of noTangent means none,
+    // shaders then build a frame around the normal.
+    struct PackedVertex {
+        // -32768 in both halves, packSnorm2x16 clamps to -32767 so no direction encodes to it
+        static constexpr uint32_t noTangent = 0x80008000u;
+
+        uint32_t normal;
+        uint32_t texCoord;
+        uint32_t tangent;
+
+        static glm::vec2 octEncode(glm::vec3 n) {
+            n /= glm::abs(n.x) + glm::abs(n.y) + glm::abs(n.z);
+            glm::vec2 oct(n.x, n.y);
+
+            if (n.z < 0.0f)
+                oct = (1.0f - glm::abs(glm::vec2(n.y, n.x))) * glm::vec2(n.x >= 0.0f ? 1.0f : -1.0f, n.y >= 0.0f ? 1.0f : -1.0f);
+
+            return oct;
+        }
+
+        static PackedVertex pack(Vertex const & vertex) {
+            PackedVertex packed{};
+            packed.normal = glm::packSnorm2x16(octEncode(glm::normalize(vertex.normals)));
+            packed.texCoord = glm::packHalf2x16(vertex.texCoord);
+
+            packed.tangent = noTangent;
+            if (glm::dot(vertex.tangent, vertex.tangent) > 1e-12f)
+                packed.tangent = glm::packSnorm2x16(octEncode(glm::normalize(vertex.tangent)));
+
+            return packed;
+        }
+    };
 }
 
 namespace std {
@@ -22,6 +22,21 @@ int main(int argc, char* argv[]) {
     parser.add_option("-M,--M", params.M, "M value for RIS");
     parser.add_flag("-i,--immediate", params.immediate, "Unlock FPS");
     parser.add_flag("--100", params.multiply, "Multiply geometry");
+    parser.add_flag("--weld", params.weld, "Merge duplicate vertices on load");
+    parser.add_flag("--rebuild-cache", params.rebuildCache, "Ignore the cooked scene and textures and recook them");
+    parser.add_flag("--compact-blas", params.compactBLAS, "Compact acceleration structures after building them");
+    parser.add_flag("--animate-lights", params.animateLights, "Move the lights every frame by refitting the TLAS");
+    parser.add_flag("--host-builds", params.hostBuilds, "Build BLASes on the CPU when the device supports it");
+    parser.add_flag("--merge-static", params.mergeStatic, "Merge small nearby instances into shared BLASes");
+    parser.add_flag("--light-tree", params.lightTree, "Draw RIS candidates from a light BVH around the hit point");
+    parser.add_option("--regir-cell", params.regirCell, "Draw RIS candidates from a world space light grid with cells this large");
+    parser.add_flag("--light-tiles", params.lightTiles, "Draw RIS candidates from lights presampled into tiles every frame");
+    parser.add_option("--spatial-passes", params.spatialPasses, "Spatial reuse passes, each one reads the reservoirs the previous one wrote")->check(CLI::PositiveNumber);
+    parser.add_option("--spatial-neighbors", params.spatialNeighbors, "Neighbours every spatial pass combines");
+    parser.add_option("--spatial-radius", params.spatialRadius, "Radius in pixels spatial neighbours are picked from");
+    parser.add_option("--lights", params.lights, "Light list, scene .json or packed .lights");
+    parser.add_option("--pack-lights", params.packLights, "Write the light list to a packed .lights file and quit");
+    parser.add_flag("--cook", params.cook, "Cook the scene and every texture it uses and quit");
 
     try {
         parser.parse(argc, argv);
@@ -29,6 +44,50 @@ int main(int argc, char* argv[]) {
         return parser.exit(e);
     }
 
+    if (!params.packLights.empty()) {
+        try {
+            hd::Model_t::storeLights(params.packLights, hd::Model_t::parseLights(params.lights));
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+    }
+
+    // No device here, textures cook to BC1 and the renderer recooks them if it can't sample that
+    if (params.cook) {
+        try {
+            auto pool = hd::ThreadPool_t::conjure({});
+            auto sceneCache = hd::SceneCache_t::conjure({
+                    .filename = (params.multiply) ? "models/scene.100.hdscene" : "models/scene.hdscene",
+                    .modelFilename = "models/scene.obj",
+                    .lightsFilename = params.lights,
+                    .multiply = params.multiply,
+                    .weld = params.weld,
+                    .rebuild = params.rebuildCache,
+                    .pool = pool,
+                    });
+
+            std::vector<std::string> sources;
+            for (auto const & mesh : sceneCache->model()->meshes)
+                sources.insert(sources.end(), mesh.diffusePaths.begin(), mesh.diffusePaths.end());
+            std::sort(sources.begin(), sources.end());
+            sources.erase(std::unique(sources.begin(), sources.end()), sources.end());
+
+            pool->parallelFor(sources.size(), [&](size_t iter) {
+                hd::TextureCook_t::conjure({ .source = sources[iter], .rebuild = params.rebuildCache });
+            });
+
+            std::cout << "Cooked " << sources.size() << " textures" << std::endl;
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+    }
+
     App app(params);
 
     try {